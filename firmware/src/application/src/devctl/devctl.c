@@ -5,11 +5,11 @@
 #include "usb/nl_usb_midi.h"
 #include "midi/MIDI_statemonitor.h"
 
-static int memcmp(uint8_t const* const p, uint8_t const* const q, uint32_t const lenP, uint32_t const lenQ)
+static int isEqual(uint8_t const* const p, uint8_t const* const q, uint32_t const lenP, uint32_t const lenQ)
 {
   if (lenP != lenQ)
     return 0;
-  for (int i = 0; i < lenP; i++)
+  for (uint32_t i = 0; i < lenP; i++)
     if (p[i] != q[i])
       return 0;
   return 1;
@@ -43,7 +43,7 @@ static void execute(void)
 uint16_t DEVCTL_isDeviceControlMsg(uint8_t** const pBuff, uint32_t* const pLen)
 {
   uint32_t const ID_SIZE = sizeof NLMB_DevCtlSignature_RAW;
-  if ((*pLen >= ID_SIZE) && memcmp(*pBuff, NLMB_DevCtlSignature_RAW, ID_SIZE, ID_SIZE))
+  if ((*pLen >= ID_SIZE + 2) && isEqual(*pBuff, NLMB_DevCtlSignature_RAW, ID_SIZE, ID_SIZE))  // command included
   {
     *pBuff += ID_SIZE;
     *pLen -= ID_SIZE;
@@ -56,6 +56,43 @@ uint16_t DEVCTL_isDeviceControlMsg(uint8_t** const pBuff, uint32_t* const pLen)
   return 0;
 }
 
+// ----------------------------------------------
+// collect the plain data bytes of a device control message, up to its end
+// Buff and Len are the payload position and size DEVCTL_isDeviceControlMsg() left
+// returns the number of data bytes, at most max are stored
+uint32_t DEVCTL_getData(uint8_t const* buff, uint32_t len, uint8_t* const data, uint32_t const max)
+{
+  uint32_t n = 0;
+
+  for (; len >= 4; buff += 4, len -= 4)
+  {
+    uint8_t payload;
+    switch (*buff & 0x0F)  // mask out cable number
+    {
+      case 0x04:
+      case 0x07:
+        payload = 3;
+        break;
+      case 0x05:
+        payload = 1;
+        break;
+      case 0x06:
+        payload = 2;
+        break;
+      default:
+        return n;  // not SysEx
+    }
+    for (int i = 1; i <= payload; i++)
+    {
+      if (buff[i] == 0xF7)
+        return n;
+      if (buff[i] < 0x80 && n < max)
+        data[n++] = buff[i];
+    }
+  }
+  return n;
+}
+
 static inline void parseAndDecode(uint8_t byte)
 {
   if (byte == 0xF7)  // end of SysEx ?
@@ -3,5 +3,6 @@
 #include <stdint.h>
 
 uint16_t DEVCTL_isDeviceControlMsg(uint8_t** const pBuff, uint32_t* const pLen);
+uint32_t DEVCTL_getData(uint8_t const* buff, uint32_t len, uint8_t* const data, uint32_t const max);
 void     DEVCTL_init(uint8_t const port);
 void     DEVCTL_processMsg(uint8_t* buff, uint32_t len);
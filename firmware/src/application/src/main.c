@@ -20,8 +20,8 @@
 void M4SysTick_Init(void);
 
 /******************************************************************************/
-static int periodicTimer = TIME_SLICE;
-static int trigger       = 0;
+static int periodicTimer    = TIME_SLICE;
+static volatile int trigger = 0;
 
 volatile char dummy;
 void          dummyFunction(const char *string)
@@ -43,7 +43,6 @@ int main(void)
 
   while (1)
   {
-    MIDI_Relay_ProcessFast();
     if (trigger)
     {
       trigger = 0;
@@ -73,6 +72,7 @@ void M4SysTick_Init(void)
 void SysTick_Handler(void)
 {
   ticker++;
+  MIDI_Relay_Tick();  // runs at the priority of the USB interrupts
   if (!--periodicTimer)
   {
     periodicTimer = TIME_SLICE;
@@ -0,0 +1,161 @@
+#include "midi/MIDI_arena.h"
+#include "sys/nl_stdlib.h"
+
+static uint8_t bank0[ARENA_CHUNKS_0][ARENA_CHUNK_SIZE] __attribute__((aligned(4))) __attribute__((section(".noinit.$RamLoc32")));
+static uint8_t bank1[ARENA_CHUNKS_1][ARENA_CHUNK_SIZE] __attribute__((aligned(4))) __attribute__((section(".noinit.$RamAHB_ETB16")));
+
+static uint8_t next[ARENA_CHUNKS];  // chain links, also links the free list
+static uint8_t freeList;
+static uint8_t freeCount;
+
+static struct
+{
+  uint8_t  head;      // oldest chunk in use
+  uint8_t  tail;      // chunk being filled
+  uint16_t tailUsed;  // bytes used in it
+} lane[ARENA_OWNERS];
+
+static ArenaStats_t stats[ARENA_OWNERS];
+static ArenaStats_t total;
+
+static inline uint8_t *chunkData(uint8_t const chunk)
+{
+  if (chunk < ARENA_CHUNKS_0)
+    return bank0[chunk];
+  return bank1[chunk - ARENA_CHUNKS_0];
+}
+
+static inline uint8_t allocChunk(uint8_t const owner)
+{
+  uint8_t const chunk = freeList;
+
+  freeList    = next[chunk];
+  next[chunk] = ARENA_NONE;
+  freeCount--;
+  stats[owner].inUse++;
+  if (stats[owner].inUse > stats[owner].highWater)
+    stats[owner].highWater = stats[owner].inUse;
+  total.inUse++;
+  if (total.inUse > total.highWater)
+    total.highWater = total.inUse;
+  return chunk;
+}
+
+static inline void freeChunk(uint8_t const owner, uint8_t const chunk)
+{
+  next[chunk] = freeList;
+  freeList    = chunk;
+  freeCount++;
+  stats[owner].inUse--;
+  total.inUse--;
+}
+
+void ARENA_Init(void)
+{
+  for (uint8_t i = 0; i < ARENA_CHUNKS; i++)
+    next[i] = (i + 1 < ARENA_CHUNKS) ? i + 1 : ARENA_NONE;
+  freeList  = 0;
+  freeCount = ARENA_CHUNKS;
+  for (int i = 0; i < ARENA_OWNERS; i++)
+  {
+    lane[i].head = lane[i].tail = ARENA_NONE;
+    stats[i].inUse              = 0;
+  }
+  total.inUse = 0;
+}
+
+// give back all chunks of an owner
+void ARENA_Reset(uint8_t const owner)
+{
+  while (lane[owner].head != ARENA_NONE)
+  {
+    uint8_t const chunk = lane[owner].head;
+    lane[owner].head    = next[chunk];
+    freeChunk(owner, chunk);
+  }
+  lane[owner].tail = ARENA_NONE;
+}
+
+// append a packet to the chain of an owner, returns the chunk it starts in and the offset
+// into it, or ARENA_NONE when it does not fit
+uint8_t ARENA_Store(uint8_t const owner, uint8_t const *const data, uint32_t const len, uint16_t *const pOffset)
+{
+  uint32_t start = (lane[owner].tailUsed + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+  uint32_t room  = (lane[owner].tail != ARENA_NONE && start < ARENA_CHUNK_SIZE) ? ARENA_CHUNK_SIZE - start : 0;
+  uint32_t done, cnt;
+  uint8_t  first;
+
+  if (len == 0 || (len > room && (len - room + ARENA_CHUNK_SIZE - 1) / ARENA_CHUNK_SIZE > freeCount))
+  {
+    stats[owner].failed++;
+    total.failed++;
+    return ARENA_NONE;
+  }
+
+  if (!room)
+  {  // start a new chunk
+    uint8_t const chunk = allocChunk(owner);
+    if (lane[owner].tail == ARENA_NONE)
+      lane[owner].head = chunk;
+    else
+      next[lane[owner].tail] = chunk;
+    lane[owner].tail = chunk;
+    start            = 0;
+    room             = ARENA_CHUNK_SIZE;
+  }
+  first    = lane[owner].tail;
+  *pOffset = start;
+
+  for (done = 0; done < len; done += cnt)
+  {
+    if (!room)
+    {
+      uint8_t const chunk    = allocChunk(owner);
+      next[lane[owner].tail] = chunk;
+      lane[owner].tail       = chunk;
+      start                  = 0;
+      room                   = ARENA_CHUNK_SIZE;
+    }
+    cnt = (len - done < room) ? len - done : room;
+    memcpy(chunkData(lane[owner].tail) + start, (uint8_t *) &data[done], cnt);
+    start += cnt;
+    room -= cnt;
+  }
+  lane[owner].tailUsed = start;
+  return first;
+}
+
+// release the oldest packet of an owner, which starts in chunk and ends at end bytes from its start
+void ARENA_Release(uint8_t const owner, uint8_t chunk, uint32_t const end)
+{
+  for (uint32_t i = (end - 1) / ARENA_CHUNK_SIZE; i; i--)
+    chunk = next[chunk];
+  // chunk now holds the last byte of the packet, all chunks before it are done
+  while (lane[owner].head != chunk)
+  {
+    uint8_t const done = lane[owner].head;
+    lane[owner].head   = next[done];
+    freeChunk(owner, done);
+  }
+  if (chunk == lane[owner].tail && (end - 1) % ARENA_CHUNK_SIZE + 1 == lane[owner].tailUsed)
+    ARENA_Reset(owner);  // nothing stored behind it
+}
+
+// data at an offset into a chain, and the number of bytes stored contiguously from there
+uint8_t *ARENA_Data(uint8_t chunk, uint32_t const offset, uint32_t *const pRun)
+{
+  for (uint32_t i = offset / ARENA_CHUNK_SIZE; i; i--)
+    chunk = next[chunk];
+  *pRun = ARENA_CHUNK_SIZE - offset % ARENA_CHUNK_SIZE;
+  return chunkData(chunk) + offset % ARENA_CHUNK_SIZE;
+}
+
+ArenaStats_t const *ARENA_GetStats(uint8_t const owner)
+{
+  return &stats[owner];
+}
+
+ArenaStats_t const *ARENA_GetTotalStats(void)
+{
+  return &total;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+
+// packet store in the otherwise unused RamLoc32 and RamAHB_ETB16 banks, for lossless buffering.
+// Memory is handed out in fixed size chunks from a pool shared by all owners. Each owner fills
+// its own chain of chunks like a FIFO, packets are stored back to back and released in order.
+#define ARENA_CHUNK_SIZE (512)                        // multiple of the bulk packet sizes
+#define ARENA_ALIGN      (4)                          // packets start on USB-MIDI event boundaries
+#define ARENA_QUEUES     (0x1800)                                     // of RamAHB_ETB16, left to the relay's packet queues
+#define ARENA_CHUNKS_0   (0x8000 / ARENA_CHUNK_SIZE)                  // RamLoc32
+#define ARENA_CHUNKS_1   ((0x4000 - ARENA_QUEUES) / ARENA_CHUNK_SIZE)  // RamAHB_ETB16
+#define ARENA_CHUNKS     (ARENA_CHUNKS_0 + ARENA_CHUNKS_1)
+#define ARENA_NONE       (0xFF)  // no chunk
+#define ARENA_OWNERS     (2)     // one per relay direction
+
+typedef struct
+{
+  uint32_t inUse;      // chunks currently held
+  uint32_t highWater;  // max. chunks held at a time
+  uint32_t failed;     // packets that did not fit
+} ArenaStats_t;
+
+// all functions must be called from USB interrupt context or with interrupts disabled
+void     ARENA_Init(void);
+void     ARENA_Reset(uint8_t const owner);
+uint8_t  ARENA_Store(uint8_t const owner, uint8_t const *const data, uint32_t const len, uint16_t *const pOffset);
+void     ARENA_Release(uint8_t const owner, uint8_t const chunk, uint32_t const end);
+uint8_t *ARENA_Data(uint8_t chunk, uint32_t const offset, uint32_t *const pRun);
+
+ArenaStats_t const *ARENA_GetStats(uint8_t const owner);
+ArenaStats_t const *ARENA_GetTotalStats(void);
@@ -0,0 +1,116 @@
+#include "midi/MIDI_clock.h"
+
+#define ALPHA_SHIFT (3)  // phase follows 1/8 of the error per tick ...
+#define BETA_SHIFT  (6)  // ... and the period 1/64 of it
+#define GAP_PERIODS (4)  // a gap of this many periods restarts the filter
+
+/******************************************************************************/
+/** @brief		Reset a clock filter
+    @param[in]	delayTicks	latency added for smoothing, in ticker periods.
+							Should cover the jitter of the incoming clock.
+*******************************************************************************/
+void CLOCK_Init(ClockFilter_t *const f, uint32_t const delayTicks)
+{
+  *f       = (ClockFilter_t){ 0 };
+  f->delay = delayTicks << CLOCK_FRAC;
+}
+
+static inline void schedule(ClockFilter_t *const f, uint64_t const time)
+{
+  if (f->dueCount >= CLOCK_PENDING)
+  {  // can only happen with a delay longer than several periods
+    f->overflow++;
+    return;
+  }
+  f->due[(f->dueHead + f->dueCount) % CLOCK_PENDING] = time;
+  f->dueCount++;
+}
+
+/******************************************************************************/
+/** @brief		A clock tick was received
+    @param[in]	now		ticker time of the reception
+*******************************************************************************/
+void CLOCK_Input(ClockFilter_t *const f, uint64_t const now)
+{
+  uint64_t const t        = now << CLOCK_FRAC;
+  uint64_t const target   = t + f->delay;
+  uint64_t const interval = (now - f->lastIn) << CLOCK_FRAC;
+  uint64_t       out;
+
+  f->stats.in++;
+  if (f->stats.in == 1)
+    out = target;  // very first tick, nothing known yet
+  else if (!f->period)
+  {  // second tick gives the first period
+    f->period = interval;
+    out       = target;
+  }
+  else
+  {
+    uint64_t const predicted = f->phase + f->period;
+    int64_t const  err       = (int64_t)(target - predicted);
+
+    if (interval > (uint64_t) GAP_PERIODS * f->period || err > (int64_t)(f->period / 2) || -err > (int64_t)(f->period / 2))
+    {  // clock was stopped, or the tempo jumped : start over from this tick
+      if (interval <= (uint64_t) GAP_PERIODS * f->period)
+        f->period = interval;
+      f->stats.resyncs++;
+      out = target;
+    }
+    else
+    {
+      out = predicted + (err >> ALPHA_SHIFT);
+      f->period += err >> BETA_SHIFT;
+    }
+  }
+  // never before the tick came in, and at most twice the delay after it
+  if (out < t)
+    out = t;
+  if (out > target + f->delay)
+    out = target + f->delay;
+
+  f->phase        = out;
+  f->lastIn       = now;
+  f->stats.period = f->period;
+  schedule(f, (out + (1 << (CLOCK_FRAC - 1))) >> CLOCK_FRAC);
+}
+
+/******************************************************************************/
+/** @brief		Take the ticks that are to be sent now
+    @param[in]	now		ticker time
+    @param[in]	room	max. ticks the caller can send, the rest keeps waiting
+    @return		number of clock ticks to send
+*******************************************************************************/
+unsigned CLOCK_Due(ClockFilter_t *const f, uint64_t const now, unsigned const room)
+{
+  unsigned n = (f->overflow < room) ? f->overflow : room;
+
+  f->overflow -= n;
+  while (n < room && f->dueCount && f->due[f->dueHead] <= now)
+  {
+    f->dueHead = (f->dueHead + 1) % CLOCK_PENDING;
+    f->dueCount--;
+    n++;
+  }
+  f->stats.out += n;
+  return n;
+}
+
+/******************************************************************************/
+/** @brief		Take all waiting ticks, e.g. to send them before a Stop
+    @param[in]	room	max. ticks the caller can send, the rest keeps waiting
+    @return		number of clock ticks to send
+*******************************************************************************/
+unsigned CLOCK_Flush(ClockFilter_t *const f, unsigned const room)
+{
+  unsigned n = (f->overflow < room) ? f->overflow : room;
+
+  f->overflow -= n;
+  for (; n < room && f->dueCount; n++)
+  {
+    f->dueHead = (f->dueHead + 1) % CLOCK_PENDING;
+    f->dueCount--;
+  }
+  f->stats.out += n;
+  return n;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+// MIDI timing clock regeneration. Incoming clock ticks are timestamped on the 125us ticker, a tempo tracking
+// filter (alpha-beta, i.e. a 2nd order PLL on phase and period) smooths their times, and each one is sent on
+// at its smoothed time, about the configured delay later. Every incoming tick gives exactly one outgoing tick,
+// ticks the caller has no room for yet stay waiting and are only counted as sent once taken.
+#define CLOCK_FRAC    (8)  // fractional bits of the filter's times and period
+#define CLOCK_PENDING (4)  // max. ticks waiting to be sent
+
+typedef struct
+{
+  uint32_t in;       // clock ticks received
+  uint32_t out;      // clock ticks sent
+  uint32_t resyncs;  // filter restarts, on a gap in the clock or a tempo jump
+  uint32_t period;   // smoothed clock period, in 1/256 ticker periods
+} ClockStats_t;
+
+typedef struct
+{
+  uint32_t     delay;   // latency added for smoothing, fixed-point
+  uint32_t     period;  // smoothed clock period, fixed-point, 0 --> not known yet
+  uint64_t     phase;   // smoothed time of the previous tick, fixed-point
+  uint64_t     lastIn;  // ticker time of the previous input tick
+  uint64_t     due[CLOCK_PENDING];  // ticker times the waiting ticks are sent at
+  unsigned     dueHead;
+  unsigned     dueCount;
+  unsigned     overflow;  // ticks to be sent right away, due ones found the queue full
+  ClockStats_t stats;
+} ClockFilter_t;
+
+void     CLOCK_Init(ClockFilter_t *const f, uint32_t const delayTicks);
+void     CLOCK_Input(ClockFilter_t *const f, uint64_t const now);
+unsigned CLOCK_Due(ClockFilter_t *const f, uint64_t const now, unsigned const room);
+unsigned CLOCK_Flush(ClockFilter_t *const f, unsigned const room);
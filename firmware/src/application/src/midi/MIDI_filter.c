@@ -0,0 +1,53 @@
+#include "midi/MIDI_filter.h"
+
+// status byte of a channel message
+#define IS_CHANNEL(s) ((s) >= 0x80 && (s) < 0xF0)
+
+#define KEEP(s) !(((s) == 0xF8 && FILTER_DROP_CLOCK) || ((s) == 0xFE && FILTER_DROP_SENSING) \
+                  || (IS_CHANNEL(s) && ((FILTER_DROP_CHANNELS >> ((s) &0x0F)) & 1)))
+#define MAP(s)  (IS_CHANNEL(s) ? (((s) &0xF0) | ((FILTER_CHANNEL_MAP >> (4 * ((s) &0x0F))) & 0x0F)) : (s))
+
+// high byte : bytes to advance the output by, 4 --> event is kept, low byte : bits to flip in the status byte
+#define ENTRY(s) (uint16_t)((KEEP(s) ? 0x400 : 0) | ((s) ^ MAP(s)))
+#define ROW(r)                                                                                         \
+  ENTRY(r + 0x0), ENTRY(r + 0x1), ENTRY(r + 0x2), ENTRY(r + 0x3), ENTRY(r + 0x4), ENTRY(r + 0x5),      \
+      ENTRY(r + 0x6), ENTRY(r + 0x7), ENTRY(r + 0x8), ENTRY(r + 0x9), ENTRY(r + 0xA), ENTRY(r + 0xB), \
+      ENTRY(r + 0xC), ENTRY(r + 0xD), ENTRY(r + 0xE), ENTRY(r + 0xF)
+
+// entry 0 keeps and passes unchanged, which is what the CINs not looked up get
+static uint16_t const statusTable[256] = {
+  ROW(0x00), ROW(0x10), ROW(0x20), ROW(0x30), ROW(0x40), ROW(0x50), ROW(0x60), ROW(0x70),
+  ROW(0x80), ROW(0x90), ROW(0xA0), ROW(0xB0), ROW(0xC0), ROW(0xD0), ROW(0xE0), ROW(0xF0),
+};
+
+// mask applied to the status byte before the lookup : channel messages and single bytes are looked up,
+// SysEx, system common and the reserved CINs are passed on
+static uint8_t const cinTable[16] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // reserved, system common, SysEx
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,  // channel messages, single byte
+};
+
+/******************************************************************************/
+/** @brief		Apply the filter and remap rules to received data, in place
+    @param[in]	buff	USB-MIDI event packets
+    @param[in]	len		length in bytes
+    @return		length of the remaining data
+*******************************************************************************/
+uint32_t FILTER_Apply(uint8_t *const buff, uint32_t const len)
+{
+  uint32_t kept = 0;
+  uint32_t i;
+
+  for (i = 0; i + 4 <= len; i += 4)
+  {  // always written, the output only advances for kept events
+    uint32_t const e = statusTable[buff[i + 1] & cinTable[buff[i] & 0x0F]];
+    buff[kept]       = buff[i];
+    buff[kept + 1]   = buff[i + 1] ^ (uint8_t) e;
+    buff[kept + 2]   = buff[i + 2];
+    buff[kept + 3]   = buff[i + 3];
+    kept += e >> 8;
+  }
+  for (; i < len; i++)  // trailing garbage is passed on as it is
+    buff[kept++] = buff[i];
+  return kept;
+}
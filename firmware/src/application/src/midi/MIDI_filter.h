@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+// Filter and channel remap stage, applied to received data before it is relayed. The rules are fixed at
+// compile time and turned into two constant tables : one per Code Index Number telling whether the status
+// byte is looked up, and one per status byte telling whether the event is kept and what the status becomes.
+// Every event packet takes the same two lookups, so the cost per packet only depends on its length.
+#ifndef FILTER_DROP_CLOCK
+#define FILTER_DROP_CLOCK (0)  // drop timing clock (F8)
+#endif
+#ifndef FILTER_DROP_SENSING
+#define FILTER_DROP_SENSING (0)  // drop active sensing (FE)
+#endif
+#ifndef FILTER_DROP_CHANNELS
+#define FILTER_DROP_CHANNELS (0x0000)  // bit n set --> drop channel messages of MIDI channel n+1
+#endif
+#ifndef FILTER_CHANNEL_MAP
+#define FILTER_CHANNEL_MAP (0xFEDCBA9876543210)  // nibble n is the channel (0..15) that channel n is sent on
+#endif
+
+#define FILTER_IDENTITY (0xFEDCBA9876543210)
+#define FILTER_ACTIVE   (FILTER_DROP_CLOCK || FILTER_DROP_SENSING || FILTER_DROP_CHANNELS || FILTER_CHANNEL_MAP != FILTER_IDENTITY)
+
+uint32_t FILTER_Apply(uint8_t *const buff, uint32_t const len);
@@ -0,0 +1,83 @@
+#include "midi/MIDI_generator.h"
+#include "midi/nl_sysex.h"
+#include "sys/nl_stdlib.h"
+
+#define TICKS_PER_SECOND (8000ull)
+
+static uint8_t payload[GEN_MAX_SIZE] __attribute__((aligned(8))) __attribute__((section(".noinit.$RamAHB32")));
+
+/******************************************************************************/
+/** @brief		Start the generator, message numbers start at 0
+    @param[in]	blockSize	like perf-test's : bytes of the counter pattern, rounded
+							up to even
+    @param[in]	rate		messages per second, 0 --> as fast as the host takes them
+    @param[in]	now			ticker time
+*******************************************************************************/
+void GEN_Start(Generator_t *const g, uint32_t const blockSize, uint32_t const rate, uint64_t const now)
+{
+  uint32_t const size = PERF_HEADER_SIZE + ((blockSize + 1) & ~1u);
+
+  *g        = (Generator_t){ 0 };
+  g->size   = (size > GEN_MAX_SIZE) ? GEN_MAX_SIZE : size;
+  g->period = rate ? (TICKS_PER_SECOND << GEN_FRAC) / rate : 0;
+  g->due    = now << GEN_FRAC;
+}
+
+/******************************************************************************/
+/** @brief		Stop the generator
+*******************************************************************************/
+void GEN_Stop(Generator_t *const g)
+{
+  g->size = 0;
+}
+
+/******************************************************************************/
+/** @brief		Is the next message due ?
+    @details	A host taking the data too slowly does not get a burst once it
+				catches up : periods missed by more than one are skipped, the
+				receiving host sees them as a gap in the send times.
+*******************************************************************************/
+int GEN_Due(Generator_t *const g, uint64_t const now)
+{
+  uint64_t const t = now << GEN_FRAC;
+
+  if (!g->size)
+    return 0;
+  if (t < g->due)
+    return 0;
+  if (g->period && t - g->due > g->period)
+    g->due = t;
+  return 1;
+}
+
+/******************************************************************************/
+/** @brief		Build the next message
+    @param[in]	usecs	device time, goes into the header
+    @param[out]	dest	GEN_RAW_SIZE(GEN_MAX_SIZE) bytes at least
+    @return		raw USB-MIDI bytes of the message
+*******************************************************************************/
+uint32_t GEN_Build(Generator_t const *const g, uint64_t const usecs, uint8_t *const dest)
+{
+  uint64_t *const header = (uint64_t *) payload;
+  uint16_t *      p      = (uint16_t *) &payload[PERF_HEADER_SIZE];
+  uint16_t        val    = g->messageNo & 0xFFFF;
+
+  header[PERF_FIELD_TIME]    = usecs;
+  header[PERF_FIELD_NUMBER]  = g->messageNo;
+  header[PERF_FIELD_SIZE]    = g->size;
+  header[PERF_FIELD_MAGIC]   = PERF_STAMP_MAGIC;
+  header[PERF_FIELD_INGRESS] = usecs;  // built and queued right away
+  header[PERF_FIELD_EGRESS]  = usecs;
+  for (uint32_t i = 0; i < (g->size - PERF_HEADER_SIZE) / 2; i++)
+    *p++ = val++;
+  return MIDI_encodeRawSysex(payload, g->size, dest);
+}
+
+/******************************************************************************/
+/** @brief		The message built last was queued for transmit
+*******************************************************************************/
+void GEN_Sent(Generator_t *const g)
+{
+  g->messageNo++;
+  g->due += g->period;
+}
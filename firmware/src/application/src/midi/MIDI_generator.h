@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+#include "midi/nl_perftest_defs.h"
+
+// Test traffic generator, see CMD_GENERATE. Builds the messages of perf-test, see nl_perftest_defs.h,
+// with the bridge's time in usecs. The receiving host checks them with "perf-test -rl".
+#define GEN_MAX_SIZE (1024)  // max. payload bytes per message
+#define GEN_FRAC     (8)     // fractional bits of the message period
+
+// raw USB-MIDI bytes of a message : F0, payload plus a top-bits byte per 7 bytes, F7, in 3-byte event packets
+#define GEN_RAW_SIZE(size) ((((size) + ((size) + 6) / 7 + 2 + 2) / 3) * 4)
+
+typedef struct
+{
+  uint32_t size;       // payload bytes per message, 0 --> off
+  uint32_t period;     // between messages, in 1/256 ticker periods, 0 --> as fast as the host takes them
+  uint64_t due;        // when the next message is to be sent, fixed-point
+  uint64_t messageNo;  // of the next message
+} Generator_t;
+
+void     GEN_Start(Generator_t *const g, uint32_t const blockSize, uint32_t const rate, uint64_t const now);
+void     GEN_Stop(Generator_t *const g);
+int      GEN_Due(Generator_t *const g, uint64_t const now);
+uint32_t GEN_Build(Generator_t const *const g, uint64_t const usecs, uint8_t *const dest);
+void     GEN_Sent(Generator_t *const g);
@@ -3,10 +3,16 @@
 #include "usb/nl_usb_core.h"
 #include "usb/nl_usb_descmidi.h"
 #include "io/pins.h"
-#include "drv/error_display.h"
 #include "sys/nl_stdlib.h"
 #include "sys/ticker.h"
 #include "midi/MIDI_statemonitor.h"
+#include "midi/MIDI_arena.h"
+#include "midi/MIDI_clock.h"
+#include "midi/MIDI_filter.h"
+#include "midi/MIDI_validate.h"
+#include "midi/MIDI_generator.h"
+#include "midi/MIDI_stamp.h"
+#include "midi/nl_sysex.h"
 #include "devctl/devctl.h"
 #include "midi/nl_devctl_defs.h"
 #include "cmsis/LPC43xx.h"
@@ -17,21 +23,160 @@
 #warning "This build will use long packet timeouts!"
 #endif
 
+#ifdef LOSSLESS_BUFFERING
+#warning "This build will buffer stalled packets in the arena instead of dropping them!"
+#endif
+
+#ifdef PERF_TIMESTAMPS
+#warning "This build will write timestamps into perf-test messages!"
+#endif
+
+#ifdef STRIP_MALFORMED
+#warning "This build will remove malformed USB-MIDI event packets!"
+#endif
+
+#ifdef FAST_LANE_ENDPOINTS
+#warning "This build will offer a second MIDI Streaming interface with its own endpoint pair!"
+#endif
+
+// All relay state, and the state of the USB-MIDI driver below it, is owned by one interrupt priority level :
+// the two USB interrupts and the SysTick exception run at RELAY_IRQ_PRIORITY, so none of them ever preempts
+// another and no access needs to be guarded. The main loop hands the state over once, by setting relayRunning
+// at the end of MIDI_Relay_Init(), and does not touch it after that. Data flows only through the USB interrupts,
+// MIDI_Relay_Tick() is called from SysTick for the timers and the port status.
+#define RELAY_IRQ_PRIORITY (0)
+
 #define usToTicks(x) ((x + 75ul) / 125ul)     // usecs to 125 ticker counts
 #define msToTicks(x) (((x) *1000ul) / 125ul)  // msecs to 125 ticker counts
 
-//timeout in usecs until a first packet is aborted
-// short timeout in usecs until the next packet is aborted
+// Packet timeouts are derived from how long the outgoing host takes to accept a transfer : smoothed time plus
+// 4 times its mean deviation, but at least twice the longest recent stall, which is also raised by each timeout.
+// The packet following a drop gets the smoothed time plus one deviation only.
+// Until the host was measured the initial timeouts are used, the learned ones are kept within the bounds.
 #ifndef LONG_PACKET_TIMEOUTS
 
-#define PACKET_TIMEOUT       msToTicks(100)
-#define PACKET_TIMEOUT_SHORT msToTicks(5)
+#define PACKET_TIMEOUT       msToTicks(100)  // initial timeout until a first packet is aborted
+#define PACKET_TIMEOUT_SHORT msToTicks(5)    // initial timeout until the next packet is aborted, and lower bound
+#define PACKET_TIMEOUT_MIN   msToTicks(20)   // lower bound of the timeout
+#define PACKET_TIMEOUT_MAX   msToTicks(1000)
+#define PACKET_PEAK_DECAY    msToTicks(250)  // longest recent stall is decreased by 1/8 in each such period
 
 #else
 
 #define PACKET_TIMEOUT       msToTicks(1000)
 #define PACKET_TIMEOUT_SHORT msToTicks(100)
+#define PACKET_TIMEOUT_MIN   msToTicks(200)
+#define PACKET_TIMEOUT_MAX   msToTicks(10000)
+#define PACKET_PEAK_DECAY    msToTicks(2500)
+
+#endif
+
+// max. latency in usecs added by merging FS packets into larger HS transfers, 0 disables merging
+#ifndef COALESCE_LATENCY_US
+#define COALESCE_LATENCY_US (0)
+#endif
+
+// latency in usecs given to the MIDI clock filter, incoming clock ticks are sent on smoothed. 0 passes them unchanged
+#ifndef CLOCK_REGEN_DELAY_US
+#define CLOCK_REGEN_DELAY_US (0)
+#endif
+
+// packets queued for a direction from which on it counts as congested, 0 disables thinning.
+// While congested, active sensing and values overwritten later on are taken out of all data not in transmit yet.
+#ifndef THIN_QUEUE_DEPTH
+#define THIN_QUEUE_DEPTH (0)
+#endif
+
+// number of urgent event packets (real-time and channel messages) that can wait for the priority lane
+#define URGENT_EVENTS (64)
+
+// max. size in bytes of a single bulk transmit, larger packets are sent in pieces so that
+// urgent events can go out in between, 0 sends packets as a whole.
+// Must be a multiple of the FS bulk packet size.
+#ifndef TRANSMIT_QUANTUM
+#define TRANSMIT_QUANTUM (0)
+#endif
+#if (TRANSMIT_QUANTUM % USB_FS_BULK_SIZE) != 0
+#error "TRANSMIT_QUANTUM must be a multiple of the FS bulk packet size"
+#endif
+
+// max. number of bulk transmits queued at a time, urgent events have to wait for these only.
+// Pieces are queued one by one from the completion interrupt of the previous one.
+#if TRANSMIT_QUANTUM > 0
+#define BULK_QUEUE_DEPTH (1)
+#else
+#define BULK_QUEUE_DEPTH (2)
+#endif
+
+// With more than one cable the bulk data is not sent packet by packet : the events of each cable are taken out of
+// the queued packets into transfers of their own, the cables in turn with up to their weight times CABLE_QUANTUM
+// events per round, so a SysEx dump on one cable does not hold up the others. Weights are a nibble per cable,
+// from cable 0 on, 0 counts as 1. Event packets of higher cable numbers go with the last cable.
+#if USB_MIDI_CABLES > 1
+#ifndef CABLE_WEIGHTS
+#define CABLE_WEIGHTS (0x1111)
+#endif
+#define CABLE_QUANTUM (16)
+#if TRANSMIT_QUANTUM > 0
+#define CABLE_BUFFER_SIZE (TRANSMIT_QUANTUM)
+#else
+#define CABLE_BUFFER_SIZE (USB_HS_BULK_SIZE)
+#endif
+#endif
+
+// The fast lane is relayed apart from all of the above : its data arrives on an endpoint pair of its own and is
+// collected into one half of a buffer while the other half is in transmit, so nothing but its own data is ever
+// queued ahead of it. It always goes to the other port, echo mode and the generator only take the main endpoints.
+// Received data that does not fit the collecting half keeps its receive slot until it does, so the sending host
+// is NAKed meanwhile. A transmit the outgoing host does not take within FAST_LANE_TIMEOUT is flushed, the host
+// may not have the fast lane open at all, this is the only place fast lane data is dropped.
+#ifdef FAST_LANE_ENDPOINTS
+#define FAST_LANE_SIZE    (256)  // bytes per buffer half
+#define FAST_LANE_TIMEOUT msToTicks(20)
+#endif
+
+// Output shaper, per port, set by the host on it with CMD_SHAPE : a token bucket filled at the byte rate the host
+// asked for, up to the burst size. Bulk transmits and test traffic wait until the bucket holds their size, or
+// the burst size for larger ones, urgent and fast lane transfers never wait but take their share from it, too.
+// Waiting for the shaper is not counted against the host, the packet timeout only runs while data is in transmit.
+#define SHAPER_FRAC          (8)    // fractional bits of the tokens, in bytes
+#define SHAPER_BURST_DEFAULT (512)  // one HS bulk packet
+
+// device control replies : values and parameters repeated from the query, at most
+#define REPLY_MAX_SIZE   (2 * STATS_FIELDS * 4)
+#define REPLY_MAX_PARAMS (3)
+#if RELAY_HIST_BUCKETS != HIST_BUCKETS || RELAY_HIST_BUCKETS * 4 > REPLY_MAX_SIZE
+#error "histogram layout does not match CMD_HISTOGRAM"
+#endif
+// 3 bytes per event packet : 7 bytes of signature, command, 0x01, parameters, encoded values and the F7
+#if (7 + 2 + REPLY_MAX_PARAMS + REPLY_MAX_SIZE + (REPLY_MAX_SIZE + 6) / 7 + 1 + 2) / 3 > URGENT_EVENTS
+#error "device control replies do not fit into the priority lane"
+#endif
+
+// marks an urgent transfer in the list of queued transmits
+#define SENT_URGENT (0xFF)
 
+// what is thrown away when the outgoing host does not take a transfer within the packet timeout
+#define DROP_OLDEST      (0)  // flush the transmit queue and the packets in it
+#define DROP_NEWEST      (1)  // keep what is in transmit for one more timeout, dismiss the packets behind and new arrivals
+#define DROP_SYSEX       (2)  // like DROP_OLDEST, but non-SysEx events of the dropped packets are kept
+#define DROP_CLOSE_SYSEX (3)  // like DROP_OLDEST, but a SysEx cut off is terminated with an F7
+#ifndef DROP_POLICY
+#define DROP_POLICY DROP_OLDEST
+#endif
+#if DROP_POLICY < DROP_OLDEST || DROP_POLICY > DROP_CLOSE_SYSEX
+#error "DROP_POLICY must be one of DROP_OLDEST, DROP_NEWEST, DROP_SYSEX, DROP_CLOSE_SYSEX"
+#endif
+// the SysEx aware policies also discard the rest of a SysEx cut off, up to its end
+#define DROP_SYSEX_AWARE (DROP_POLICY == DROP_SYSEX || DROP_POLICY == DROP_CLOSE_SYSEX)
+
+// packet queues hold one entry per receive buffer, plus as many as there are arena chunks for packets moved there
+#ifndef LOSSLESS_BUFFERING
+#define QUEUE_SIZE_0 (USB_MIDI_RX_SLOTS)
+#define QUEUE_SIZE_1 (USB_MIDI_RX_SLOTS_FS)
+#else
+#define QUEUE_SIZE_0 (USB_MIDI_RX_SLOTS + ARENA_CHUNKS)
+#define QUEUE_SIZE_1 (USB_MIDI_RX_SLOTS_FS + ARENA_CHUNKS)
 #endif
 
 typedef enum
@@ -42,58 +187,1040 @@ typedef enum
   WAIT_FOR_XMIT_DONE,
 } PacketState_t;
 
+typedef struct
+{
+  uint64_t time;
+  uint8_t *pData;
+  int32_t  len;     // 0 --> packet was dismissed and only its buffer needs to be released
+  uint16_t rxLen;   // length as received, before urgent events were taken out
+  uint16_t stored;  // bytes it takes in the arena
+  uint16_t offset;  // start of the data in the arena chunk
+  uint8_t  chunk;   // arena chunk the data starts in, ARENA_NONE --> data is in the receive buffer
+} Packet_t;
+
+typedef struct
+{
+  uint8_t  data[4];  // USB-MIDI event packet
+  uint64_t time;
+} Event_t;
+
+typedef struct
+{
+  unsigned packet;  // from the queue head on
+  uint32_t offset;
+} CablePos_t;
+
+typedef struct
+{
+  uint32_t           perTick;  // tokens added per ticker period, 0 --> not shaped ...
+  int32_t            tokens;   // ... tokens held, negative after an urgent transfer overdrew them ...
+  uint64_t           last;     // ... and when they were added last
+  int                held;     // flag: a transmit was held back since the last ticker period ...
+  int                wasHeld;  // ... and in the one before
+  RelayShaperStats_t stats;
+} Shaper_t;
+
+typedef struct
+{
+  uint8_t *buff;  // received data not collected yet, its slot is released when it is all taken
+  uint32_t len;
+} FastWait_t;
+
+// they grow with the arena, so they live beside it rather than in the bank of the receive buffers
+static Packet_t queue0[QUEUE_SIZE_0] __attribute__((section(".noinit.$RamAHB_ETB16")));
+static Packet_t queue1[QUEUE_SIZE_1] __attribute__((section(".noinit.$RamAHB_ETB16")));
+
+// urgent event packets per direction, and the transfer carrying them
+static Event_t urgent0[URGENT_EVENTS] __attribute__((section(".noinit.$RamAHB32")));
+static Event_t urgent1[URGENT_EVENTS] __attribute__((section(".noinit.$RamAHB32")));
+static uint8_t urgentBuffer0[URGENT_EVENTS * 4] __attribute__((aligned(4))) __attribute__((section(".noinit.$RamAHB32")));
+static uint8_t urgentBuffer1[URGENT_EVENTS * 4] __attribute__((aligned(4))) __attribute__((section(".noinit.$RamAHB32")));
+
+// merged FS packets for one HS transfer
+static uint8_t coalesceBuffer[USB_MIDI_RX_SIZE_HS] __attribute__((aligned(4))) __attribute__((section(".noinit.$RamAHB32")));
+
+// test traffic, one message being built while the other is in transmit
+static uint8_t genBuffer[2][GEN_RAW_SIZE(GEN_MAX_SIZE)] __attribute__((aligned(4))) __attribute__((section(".noinit.$RamAHB32")));
+
+#ifdef FAST_LANE_ENDPOINTS
+// fast lane data, per direction a half collecting and a half in transmit
+static uint8_t fastBuffer[2][2][FAST_LANE_SIZE] __attribute__((aligned(4))) __attribute__((section(".noinit.$RamAHB32")));
+#endif
+
+#if USB_MIDI_CABLES > 1
+// events of the cables taken out of the queued packets, per direction and queued transmit
+static uint8_t cableBuffer[2][BULK_QUEUE_DEPTH][CABLE_BUFFER_SIZE] __attribute__((aligned(4))) __attribute__((section(".noinit.$RamAHB32")));
+#endif
+
 struct PacketTransfer;
 
 struct PacketTransfer
 {
   uint8_t const                portNo;
-  uint8_t const                outgoingPortNo;
-  struct PacketTransfer *const outgoingTransfer;
+  uint8_t                      outgoingPortNo;    // the other port, or this one in echo mode
+  struct PacketTransfer       *outgoingTransfer;  // ... and the direction coming in on it
   int                          powered;
   int                          online;
+  int                          echo;  // packets are sent back on the port they came in, see CMD_ECHO
   int                          first;
+  int                          recovering;  // controller was restarted after an error, port is not configured again yet
+  uint64_t                     faultTime;
+  RelayRecoveryStats_t         recovery;
 
-  PacketState_t state;
-  uint8_t *     pData;
-  int32_t       len;
+  Packet_t *const queue;
+  unsigned const  qSize;
+  int const       coalesce;  // merge incoming FS packets into larger transfers
+
+  Event_t *const urgent;        // priority lane, sent ahead of bulk packets not yet queued
+  uint8_t *const urgentBuffer;  // data of the urgent transfer in flight
+
+  PacketState_t state;  // of the oldest packet in the queue
+  unsigned      qHead;
+  unsigned      qCount;
+  unsigned      qHeld;    // packets holding a receive buffer, always the newest ones
+  unsigned      qSent;    // packets from the head on that are queued for transmit
+  uint32_t      qOffset;  // bytes queued of the packet behind those
+#if USB_MIDI_CABLES > 1
+  CablePos_t cable[USB_MIDI_CABLES];  // per cable : its next event not queued for transmit yet
+  unsigned   cableNext;               // cable the next transfer starts with
+  unsigned   cableBuff;               // buffer the next transfer is built in
+#endif
   uint64_t      packetTimeout;
   uint64_t      packetTime;
   int           dropped;
+  int           stalled;    // DROP_NEWEST : transmit timed out once, new arrivals are dismissed until it moves on
+  int           skipSysex;  // rest of a SysEx cut off is discarded
+  int           sysexCut;   // flags and cable number of the SysEx data seen in the packets being dropped
+  int           sysexOpen;
+  uint8_t       sysexCable;
+
+  unsigned urgentHead;
+  unsigned urgentCount;
+  unsigned urgentBulk;      // packets from the head on up to the newest one with urgent events left in it, the lane was full
+  int      urgentInFlight;  // flag: an urgent transfer is queued for transmit
+  uint64_t urgentTime;      // when it was queued
+  uint64_t urgentOldest;    // reception time of the oldest event it carries ...
+  unsigned urgentEvents;    // ... and their number
+
+#ifdef FAST_LANE_ENDPOINTS
+  uint32_t   fastFill[2];   // bytes collected in the fast lane buffer halves
+  unsigned   fastCollect;   // half collecting, the other one is in transmit ...
+  int        fastInFlight;  // ... when this is set
+  uint64_t   fastTime;      // when it was queued
+  FastWait_t fastWait[USB_MIDI_FAST_SLOTS];  // receive slots waiting for room, oldest first
+  unsigned   fastWaiting;
+#endif
+
+  uint8_t  sentParts[USB_DTD_QUEUE_LEN];  // per queued transmit, in order : packets it finishes, or SENT_URGENT
+  uint64_t sentTime[USB_DTD_QUEUE_LEN];   // ... and when it was queued
+  unsigned sentHead;
+  unsigned sentCount;
+  uint64_t lastDone;  // when the outgoing host finished the last transmit
+
+  uint32_t            avgAccept8;  // smoothed accept time of the outgoing host, in 1/8 ticks ...
+  uint32_t            devAccept4;  // ... and its mean deviation, in 1/4 ticks
+  uint64_t            peakTime;    // when the longest recent stall was decreased last
+  RelayTimeoutStats_t timeouts;
+
+  RelayDelayStats_t   delay[RELAY_CLASSES];
+  RelayHistogram_t    hist[RELAY_PHASES];
+  RelayDropStats_t    drops;
+  RelayReceiveStats_t receive;
+  RelayTrafficStats_t traffic;
+
+  ClockFilter_t clock;       // regenerated MIDI clock ...
+  uint8_t       clockCable;  // ... and the cable it came in on
 };
 
 typedef struct PacketTransfer PacketTransfer_t;
 
+static volatile int relayRunning;  // flag: state is owned by the interrupt level
+
 static PacketTransfer_t packetTransfer[2] =  // port number is referring to incoming packet !
     {
-      { .first = 1, .portNo = 0, .outgoingPortNo = 1, .outgoingTransfer = &packetTransfer[1] },
-      { .first = 1, .portNo = 1, .outgoingPortNo = 0, .outgoingTransfer = &packetTransfer[0] },
+      { .first = 1, .portNo = 0, .outgoingPortNo = 1, .outgoingTransfer = &packetTransfer[1], .queue = queue0, .qSize = QUEUE_SIZE_0, .urgent = urgent0, .urgentBuffer = urgentBuffer0 },
+      { .first = 1, .portNo = 1, .outgoingPortNo = 0, .outgoingTransfer = &packetTransfer[0], .queue = queue1, .qSize = QUEUE_SIZE_1, .urgent = urgent1, .urgentBuffer = urgentBuffer1, .coalesce = (COALESCE_LATENCY_US > 0) },
     };
 
+// direction sending on each port, NULL --> none, as the other port is in echo mode or the generator has it
+static PacketTransfer_t *sender[2] = { &packetTransfer[1], &packetTransfer[0] };
+
+static Shaper_t shaper[2];  // per outgoing port
+
+static Generator_t generator;  // test traffic of CMD_GENERATE ...
+static uint8_t     genPort;    // ... sent on this port
+static unsigned    genNext;    // buffer the next message is built in
+
 // macros for providing a C++ - style "this" pointer
 #define OP         PacketTransfer_t *const t
 #define mkOP(name) PacketTransfer_t *const name
 
-static inline void packetTransferReset(OP)
+static inline void packetTransferReset(OP)
+{
+  t->state = IDLE;
+  USB_MIDI_SuspendReceive(t->portNo, 0);  // keep receiver enabled
+  USB_MIDI_ClearReceive(t->portNo);
+
+  ARENA_Reset(t->portNo);
+
+  t->qHead          = 0;
+  t->qCount         = 0;
+  t->qHeld          = 0;
+  t->qSent          = 0;
+  t->qOffset        = 0;
+  t->dropped        = 0;
+  t->stalled        = 0;
+  t->skipSysex      = 0;
+  t->sysexCut       = 0;
+  t->sysexOpen      = 0;
+  t->urgentHead     = 0;
+  t->urgentCount    = 0;
+  t->urgentBulk     = 0;
+  t->urgentInFlight = 0;
+  t->sentHead       = 0;
+  t->sentCount      = 0;
+#if USB_MIDI_CABLES > 1
+  memset(t->cable, 0, sizeof t->cable);
+  t->cableNext = 0;
+  t->cableBuff = 0;
+#endif
+#ifdef FAST_LANE_ENDPOINTS
+  if (t->fastInFlight && packetTransfer[t->portNo ^ 1].online)
+    USB_MIDI_KillFastTransmit(t->portNo ^ 1);  // it carries data of the buffer reused now
+  memset(t->fastFill, 0, sizeof t->fastFill);
+  t->fastCollect                             = 0;
+  t->fastInFlight                            = 0;
+  t->fastWaiting                             = 0;  // the receive slots are cleared with the ring
+  packetTransfer[t->portNo ^ 1].fastInFlight = 0;  // fast lane transmit going out on this port is gone
+#endif
+  CLOCK_Init(&t->clock, usToTicks(CLOCK_REGEN_DELAY_US));
+  shaper[t->portNo].perTick    = 0;  // the port's host has to ask for shaping again
+  shaper[t->portNo].stats.rate = 0;
+
+  // timeouts learned for the outgoing host of the direction sending on this port, it is this port's host
+  mkOP(o) = sender[t->portNo];
+  if (o)
+  {
+    o->timeouts      = (RelayTimeoutStats_t){ .timeoutTicks = PACKET_TIMEOUT, .shortTicks = PACKET_TIMEOUT_SHORT, .peakTicks = PACKET_TIMEOUT / 2 };
+    o->avgAccept8    = 0;
+    o->devAccept4    = 0;
+    o->peakTime      = ticker;
+    o->packetTimeout = PACKET_TIMEOUT;
+  }
+}
+
+// the direction may send : its outgoing port is up and not taken by the echo mode of that port
+static inline int outgoingOnline(OP)
+{
+  return t->outgoingTransfer->online && sender[t->outgoingPortNo] == t;
+}
+
+// set up outgoing ports and senders according to the echo modes and the generator
+static void route(void)
+{
+  for (unsigned p = 0; p < 2; p++)
+  {
+    mkOP(t)             = &packetTransfer[p];
+    t->outgoingPortNo   = t->echo ? p : p ^ 1;
+    t->outgoingTransfer = &packetTransfer[t->outgoingPortNo];
+  }
+  for (unsigned p = 0; p < 2; p++)
+    sender[p] = packetTransfer[p].echo ? &packetTransfer[p] : packetTransfer[p ^ 1].echo ? NULL : &packetTransfer[p ^ 1];
+  if (generator.size)
+    sender[genPort] = NULL;
+}
+
+// LED state monitor events, the drops are counted as well
+static inline void monitorEvent(OP, MonitorEvent_t const event)
+{
+  t->traffic.dropped += (event == PACKET_DROPPED);
+  t->traffic.droppedIncoming += (event == DROPPED_INCOMING);
+  SMON_monitorEvent(t->portNo, event);
+}
+
+// ------------------------------------------------------------
+
+// new settings for the port's host, CMD_SHAPE. The bucket starts full
+static inline void shapeSet(uint8_t const port, uint32_t const rate, uint32_t const burst)
+{
+  Shaper_t *const sh = &shaper[port];
+
+  sh->stats.rate  = rate;
+  sh->stats.burst = (burst) ? burst : SHAPER_BURST_DEFAULT;
+  sh->perTick     = ((uint64_t) rate << SHAPER_FRAC) / msToTicks(1000);
+  sh->tokens      = sh->stats.burst << SHAPER_FRAC;
+  sh->last        = ticker;
+  sh->held        = 0;
+  sh->wasHeld     = 0;
+  if (rate && !sh->perTick)
+    sh->perTick = 1;
+}
+
+// may bytes be sent to the port's host now ? Bytes are taken from the bucket when they are
+static inline int shapeAllows(uint8_t const port, uint32_t const bytes)
+{
+  Shaper_t *const sh = &shaper[port];
+
+  if (!sh->perTick)
+    return 1;
+
+  uint64_t const now   = ticker;
+  int32_t const  full  = sh->stats.burst << SHAPER_FRAC;
+  uint32_t const need  = ((bytes < sh->stats.burst) ? bytes : sh->stats.burst) << SHAPER_FRAC;
+  uint64_t const added = (now - sh->last) * sh->perTick;
+
+  sh->last   = now;
+  sh->tokens = (added >= (uint64_t)(full - sh->tokens)) ? full : sh->tokens + (int32_t) added;
+  if (sh->tokens >= (int32_t) need)
+    return 1;
+  sh->held = 1;
+  return 0;
+}
+
+static inline void shapeTake(uint8_t const port, uint32_t const bytes)
+{
+  if (shaper[port].perTick)
+    shaper[port].tokens -= bytes << SHAPER_FRAC;
+}
+
+// once per ticker period : account for the time data was held back
+static inline void shapeTick(uint8_t const port)
+{
+  Shaper_t *const sh = &shaper[port];
+
+  if (sh->held)
+  {
+    sh->stats.throttledTicks++;
+    if (!sh->wasHeld)
+      sh->stats.holds++;
+  }
+  sh->wasHeld = sh->held;
+  sh->held    = 0;
+}
+
+// the port went down, the host has to ask for test traffic again
+static inline void stopGenerator(uint8_t const port)
+{
+  if (generator.size && genPort == port)
+  {
+    GEN_Stop(&generator);
+    route();
+  }
+}
+
+// queue test traffic as it is due, up to two messages in transmit
+static inline void generate(uint64_t const now)
+{
+  if (!generator.size || !packetTransfer[genPort].online)
+    return;
+  while (USB_MIDI_PendingSends(genPort) < 2 && GEN_Due(&generator, now))
+  {
+    uint8_t *const buff = genBuffer[genNext];
+    if (!shapeAllows(genPort, GEN_RAW_SIZE(generator.size)))
+      break;
+    uint32_t const len = GEN_Build(&generator, TICKER_usecs(), buff);
+    if (USB_MIDI_Send(genPort, buff, len) < 0)
+      break;  // no room in the transmit queue, try later
+    shapeTake(genPort, len);
+    genNext = genNext ^ 1;
+    GEN_Sent(&generator);
+  }
+}
+
+static inline uint32_t clampTicks(uint32_t const ticks, uint32_t const min, uint32_t const max)
+{
+  return (ticks < min) ? min : (ticks > max) ? max : ticks;
+}
+
+static inline void updateTimeouts(OP, uint64_t const now)
+{
+  while (now - t->peakTime >= PACKET_PEAK_DECAY)
+  {
+    t->timeouts.peakTicks = t->timeouts.peakTicks * 7 / 8;
+    t->peakTime += PACKET_PEAK_DECAY;
+    if (!t->timeouts.peakTicks)
+      t->peakTime = now;
+  }
+  if (!t->timeouts.samples)
+    return;  // initial timeouts
+  uint32_t timeout = t->timeouts.acceptTicks + t->devAccept4;
+  if (timeout < 2 * t->timeouts.peakTicks)
+    timeout = 2 * t->timeouts.peakTicks;
+  t->timeouts.timeoutTicks = clampTicks(timeout, PACKET_TIMEOUT_MIN, PACKET_TIMEOUT_MAX);
+  t->timeouts.shortTicks   = clampTicks(t->timeouts.acceptTicks + t->timeouts.deviationTicks, PACKET_TIMEOUT_SHORT, t->timeouts.timeoutTicks);
+}
+
+// update the estimate of the outgoing host's accept time with a transmit it finished, and the timeouts from that
+static inline void learnAcceptTime(OP, uint32_t const ticks, uint64_t const now)
+{
+  if (ticks > t->timeouts.peakTicks)
+    t->timeouts.peakTicks = ticks;
+  if (!t->timeouts.samples++)
+  {  // first one
+    t->avgAccept8 = ticks << 3;
+    t->devAccept4 = ticks << 1;  // deviation of half the time
+  }
+  else
+  {
+    int32_t err = ticks - (t->avgAccept8 >> 3);
+    t->avgAccept8 += err;  // avg += err / 8
+    if (err < 0)
+      err = -err;
+    t->devAccept4 += err - (t->devAccept4 >> 2);  // dev += (|err| - dev) / 4
+  }
+  t->timeouts.acceptTicks    = t->avgAccept8 >> 3;
+  t->timeouts.deviationTicks = t->devAccept4 >> 2;
+  updateTimeouts(t, now);
+}
+
+// a full timeout ran out : the host may just be slower, so wait longer next time (a short one means it is likely gone)
+static inline void backOffTimeouts(OP, uint64_t const now)
+{
+  if (t->packetTimeout >= t->timeouts.timeoutTicks && t->packetTimeout > t->timeouts.peakTicks)
+    t->timeouts.peakTicks = t->packetTimeout;
+  updateTimeouts(t, now);
+}
+
+// a transmit has timed out when the outgoing host made no progress for the timeout since it was queued
+static inline int timedOut(OP, uint64_t const since, uint64_t const now)
+{
+  return (now - ((since > t->lastDone) ? since : t->lastDone)) > t->packetTimeout;
+}
+
+static inline void addHist(RelayHistogram_t *const h, uint64_t const ticks)
+{
+  unsigned const b = (ticks >= (1u << (RELAY_HIST_BUCKETS - 2))) ? RELAY_HIST_BUCKETS - 1 : (ticks) ? 32 - __builtin_clz((uint32_t) ticks) : 0;
+  h->bucket[b]++;
+}
+
+static inline void addDelay(RelayDelayStats_t *const s, uint64_t const max, unsigned const count)
+{
+  s->count += count;
+  if (max > s->maxTicks)
+    s->maxTicks = max;
+}
+
+// remember a transmit just queued, completions are retired in the same order
+static inline void sentPush(OP, uint8_t const parts)
+{
+  t->sentParts[(t->sentHead + t->sentCount) % USB_DTD_QUEUE_LEN] = parts;
+  t->sentTime[(t->sentHead + t->sentCount) % USB_DTD_QUEUE_LEN]  = ticker;
+  t->sentCount++;
+}
+
+// oldest packet is done, release its receive buffer and advance to the next one
+static inline void packetDone(OP)
+{
+  Packet_t const *const p = &t->queue[t->qHead];
+
+  if (p->chunk != ARENA_NONE)
+    ARENA_Release(t->portNo, p->chunk, p->offset + p->stored);
+  else
+  {
+    t->qHeld--;
+    USB_MIDI_ReleaseReceive(t->portNo);
+  }
+  t->qHead  = (t->qHead + 1) % t->qSize;
+  t->qCount = t->qCount - 1;
+  t->state  = (t->qCount) ? RECEIVED : IDLE;
+  if (t->qSent)
+    t->qSent--;
+  if (t->urgentBulk)
+    t->urgentBulk--;
+#if USB_MIDI_CABLES > 1
+  for (unsigned c = 0; c < USB_MIDI_CABLES; c++)
+    if (t->cable[c].packet)
+      t->cable[c].packet--;
+    else
+      t->cable[c].offset = 0;  // dropped before the cable got through it
+#endif
+}
+
+// number of packets from the head on that have data queued for transmit
+static inline unsigned queuedPackets(OP)
+{
+#if USB_MIDI_CABLES > 1
+  unsigned n = 0;
+
+  for (unsigned c = 0; c < USB_MIDI_CABLES; c++)
+  {
+    unsigned const m = t->cable[c].packet + (t->cable[c].offset != 0);
+    if (m > n)
+      n = m;
+  }
+  return n;
+#else
+  return t->qSent + (t->qOffset != 0);
+#endif
+}
+
+// data of a packet at an offset, and the number of bytes stored contiguously from there
+static inline uint8_t *packetData(Packet_t const *const p, uint32_t const offset, uint32_t *const pRun)
+{
+  uint32_t run;
+  uint8_t *data;
+
+  *pRun = p->len - offset;
+  if (p->chunk == ARENA_NONE)
+    return p->pData + offset;
+  data = ARENA_Data(p->chunk, p->offset + offset, &run);
+  if (run < *pRun)
+    *pRun = run;
+  return data;
+}
+
+// packets may only be dropped once they can no longer be buffered
+static inline int mayDrop(OP)
+{
+#ifdef LOSSLESS_BUFFERING
+  return t->qHeld != 0;  // arena is exhausted
+#else
+  (void) t;
+  return 1;
+#endif
+}
+
+// queue a bulk transmit, perf-test messages in it are stamped with the time they leave first
+static inline int32_t sendData(OP, uint8_t *const data, uint32_t const cnt)
+{
+  if (!shapeAllows(t->outgoingPortNo, cnt))
+  {  // held back by the shaper : with nothing of the direction in transmit, the host is not waited for
+    if (!queuedPackets(t))
+      t->packetTime = ticker;
+    return -1;
+  }
+#ifdef PERF_TIMESTAMPS
+  STAMP_Apply(data, cnt, PERF_FIELD_EGRESS, TICKER_usecs());
+#endif
+  int32_t const ret = USB_MIDI_Send(t->outgoingPortNo, data, cnt);
+  if (ret >= 0)
+    shapeTake(t->outgoingPortNo, cnt);
+  return ret;
+}
+
+// queue the next piece of the first packet not completely queued yet
+static inline int32_t sendBulk(OP)
+{
+  Packet_t *const p = &t->queue[(t->qHead + t->qSent) % t->qSize];
+  uint32_t        cnt;
+  uint8_t *const  data = packetData(p, t->qOffset, &cnt);
+
+#if TRANSMIT_QUANTUM > 0
+  if (cnt > TRANSMIT_QUANTUM)
+    cnt = TRANSMIT_QUANTUM;
+#endif
+  if (sendData(t, data, cnt) < 0)
+    return -1;
+  t->qOffset += cnt;
+  if (t->qOffset < (uint32_t) p->len)
+    sentPush(t, 0);  // more pieces to follow
+  else
+  {
+    t->qOffset = 0;
+    t->qSent++;
+    sentPush(t, 1);
+  }
+  return cnt;
+}
+
+// queue the packets behind the one in transmit, too, so they follow without a gap
+static inline void sendFollowing(OP)
+{
+  if (t->coalesce)
+    return;  // merged transfers are sent one at a time
+  while (t->qSent < t->qCount && USB_MIDI_PendingSends(t->outgoingPortNo) < BULK_QUEUE_DEPTH)
+  {
+    Packet_t *const p = &t->queue[(t->qHead + t->qSent) % t->qSize];
+    if (p->len == 0)
+      return;  // dismissed packet, waits until it is the oldest one
+    if (sendBulk(t) < 0)
+      return;  // no more room in the transmit queue
+  }
+}
+
+// number of packets from the head on that go into one merged transfer, and their total size
+static inline unsigned coalesceRun(OP, uint32_t *const pBytes)
+{
+  uint32_t bytes = 0;
+  unsigned n;
+
+  for (n = 0; n < t->qCount; n++)
+  {
+    Packet_t *const p = &t->queue[(t->qHead + n) % t->qSize];
+    if (p->len == 0 || bytes + p->len > sizeof coalesceBuffer)
+      break;  // dismissed packet or transfer full
+    bytes += p->len;
+    if (p->rxLen % USB_FS_BULK_SIZE)
+    {  // short packet ends the host's transfer, no more data to wait for
+      n++;
+      break;
+    }
+  }
+  *pBytes = bytes;
+  return n;
+}
+
+// merged transfer can go out when it is full, the host has ended its transfer, or the latency budget is used up
+static inline int coalesceReady(OP, uint64_t const now)
+{
+  uint32_t       bytes;
+  unsigned const n = coalesceRun(t, &bytes);
+
+  if (n < t->qCount || bytes + USB_MIDI_RX_SIZE_FS > sizeof coalesceBuffer)
+    return 1;
+  if (t->queue[(t->qHead + n - 1) % t->qSize].rxLen % USB_FS_BULK_SIZE)
+    return 1;
+#if usToTicks(COALESCE_LATENCY_US)
+  return (now - t->queue[t->qHead].time) >= usToTicks(COALESCE_LATENCY_US);
+#else
+  (void) now;
+  return 1;
+#endif
+}
+
+static inline int32_t sendCoalesced(OP)
+{
+  uint32_t bytes;
+  unsigned n = coalesceRun(t, &bytes);
+
+  bytes = 0;
+  for (unsigned i = 0; i < n; i++)
+  {
+    Packet_t *const p = &t->queue[(t->qHead + i) % t->qSize];
+    uint32_t        run;
+    for (uint32_t offset = 0; offset < (uint32_t) p->len; offset += run)
+    {
+      uint8_t *const data = packetData(p, offset, &run);
+      memcpy(&coalesceBuffer[bytes], data, run);
+      bytes += run;
+    }
+  }
+  if (sendData(t, coalesceBuffer, bytes) < 0)
+    return -1;
+  t->qSent = n;
+  sentPush(t, n);
+  return bytes;
+}
+
+#if USB_MIDI_CABLES > 1
+static inline unsigned cableLane(uint8_t const *const event)
+{
+  unsigned const c = event[0] >> 4;
+  return (c < USB_MIDI_CABLES) ? c : USB_MIDI_CABLES - 1;
+}
+
+static inline unsigned cableWeight(unsigned const c)
+{
+  unsigned const w = (CABLE_WEIGHTS >> (4 * c)) & 0x0F;
+  return w ? w : 1;
+}
+
+// copy up to a quota of a cable's events, its position ends up at the next one left.
+// Trailing garbage of a packet is not passed on, it belongs to no cable.
+static inline uint32_t takeCable(OP, unsigned const c, uint8_t *const dest, uint32_t const room, unsigned quota)
+{
+  CablePos_t *const pos   = &t->cable[c];
+  uint32_t          bytes = 0;
+  uint32_t          run;
+
+  for (; pos->packet < t->qCount; pos->packet++, pos->offset = 0)
+  {
+    Packet_t const *const p = &t->queue[(t->qHead + pos->packet) % t->qSize];
+    for (; pos->offset + 4 <= (uint32_t) p->len; pos->offset += 4)
+    {
+      uint8_t *const event = packetData(p, pos->offset, &run);
+      if (cableLane(event) != c)
+        continue;
+      if (!quota || bytes + 4 > room)
+        return bytes;
+      memcpy(&dest[bytes], event, 4);
+      bytes += 4;
+      quota--;
+    }
+  }
+  return bytes;
+}
+
+// fill a transfer with rounds over the cables, the first one changes with each transfer
+static inline uint32_t buildCables(OP, uint8_t *const dest)
+{
+  uint32_t bytes = 0;
+  uint32_t round;
+
+  do
+  {
+    round = 0;
+    for (unsigned i = 0; i < USB_MIDI_CABLES; i++)
+    {
+      unsigned const c = (t->cableNext + i) % USB_MIDI_CABLES;
+      round += takeCable(t, c, &dest[bytes + round], CABLE_BUFFER_SIZE - bytes - round, cableWeight(c) * CABLE_QUANTUM);
+    }
+    bytes += round;
+  } while (round && bytes < CABLE_BUFFER_SIZE);
+  t->cableNext = (t->cableNext + 1) % USB_MIDI_CABLES;
+  return bytes;
+}
+
+// number of packets from the head on that all cables are through with
+static inline unsigned cablesDone(OP)
+{
+  unsigned n = t->qCount;
+
+  for (unsigned c = 0; c < USB_MIDI_CABLES; c++)
+    if (t->cable[c].packet < n)
+      n = t->cable[c].packet;
+  return n;
+}
+
+// queue transfers of the cables' events, a transfer finishes the packets all cables got through with it
+static inline void sendCables(OP, uint64_t const now)
+{
+  if (t->state == RECEIVED)
+  {
+    t->packetTimeout = (!t->dropped) ? t->timeouts.timeoutTicks : t->timeouts.shortTicks;
+    t->dropped       = 0;
+    t->packetTime    = now;
+    SMON_monitorEvent(t->portNo, PACKET_START);
+    t->state = WAIT_FOR_XMIT_READY;
+  }
+  while (USB_MIDI_PendingSends(t->outgoingPortNo) < BULK_QUEUE_DEPTH)
+  {
+    CablePos_t saved[USB_MIDI_CABLES];
+    uint8_t *const buff = cableBuffer[t->portNo][t->cableBuff];
+
+    memcpy(saved, t->cable, sizeof saved);
+    uint32_t const bytes = buildCables(t, buff);
+    unsigned const done  = cablesDone(t);
+    if (!bytes)
+    {  // packets left without data, dismissed ones for example, are released once nothing is in transmit before them
+      if (!t->qSent)
+        for (unsigned n = done; n; n--)
+          packetDone(t);
+      return;
+    }
+    if (sendData(t, buff, bytes) < 0)
+    {  // no room in the transmit queue, try later
+      memcpy(t->cable, saved, sizeof saved);
+      return;
+    }
+    t->cableBuff = (t->cableBuff + 1) % BULK_QUEUE_DEPTH;
+    sentPush(t, done - t->qSent);
+    t->qSent = done;
+  }
+}
+#endif
+
+// append an event packet to the priority lane, the caller checks for room
+static inline void pushUrgent(OP, uint8_t *const event, uint64_t const time)
+{
+  Event_t *const e = &t->urgent[(t->urgentHead + t->urgentCount) % URGENT_EVENTS];
+  memcpy(e->data, event, 4);
+  e->time        = time;
+  t->urgentCount = t->urgentCount + 1;
+}
+
+#if CLOCK_REGEN_DELAY_US > 0
+static inline int isClock(uint8_t const *const event)
+{
+  return (event[0] & 0x0F) == 0x0F && event[1] == 0xF8;
+}
+
+static inline int isStop(uint8_t const *const event)
+{
+  return (event[0] & 0x0F) == 0x0F && event[1] == 0xFC;
+}
+
+// put the regenerated clock ticks due into the priority lane, as many as it has room for, the others keep
+// waiting in the filter. Before a Stop all waiting ones are due, with room left for the Stop itself. Only
+// with the lane full the ones that did not fit follow the Stop, rather than being lost
+static inline void pushClocks(OP, int const stop, uint64_t const now)
+{
+  uint8_t        event[4] = { t->clockCable | 0x0F, 0xF8, 0, 0 };
+  unsigned const room     = URGENT_EVENTS - t->urgentCount;
+
+  for (unsigned n = stop ? CLOCK_Flush(&t->clock, room ? room - 1 : 0) : CLOCK_Due(&t->clock, now, room); n; n--)
+    pushUrgent(t, event, now);
+}
+#endif
+
+// put all waiting urgent events into one transfer, ahead of any bulk packet not yet queued
+static inline void sendUrgent(OP, uint64_t const now)
+{
+  if (t->urgentInFlight || !t->urgentCount)
+    return;
+
+  unsigned const n = t->urgentCount;
+  for (unsigned i = 0; i < n; i++)
+    memcpy(&t->urgentBuffer[i * 4], t->urgent[(t->urgentHead + i) % URGENT_EVENTS].data, 4);
+  if (USB_MIDI_Send(t->outgoingPortNo, t->urgentBuffer, n * 4) < 0)
+    return;  // no room in the transmit queue, try later
+  shapeTake(t->outgoingPortNo, n * 4);
+
+  t->urgentOldest   = t->urgent[t->urgentHead].time;
+  t->urgentHead     = (t->urgentHead + n) % URGENT_EVENTS;
+  t->urgentCount    = t->urgentCount - n;
+  t->urgentInFlight = 1;
+  t->urgentTime     = now;
+  t->urgentEvents   = n;
+  sentPush(t, SENT_URGENT);
+}
+
+// retire the finished transmits, in the order they were queued
+static inline void reapSent(OP, uint64_t const now)
+{
+  uint32_t const pending = USB_MIDI_PendingSends(t->outgoingPortNo);
+
+  while (t->sentCount > pending)
+  {
+    uint8_t        parts = t->sentParts[t->sentHead];
+    uint64_t const sent  = t->sentTime[t->sentHead];
+    t->sentHead          = (t->sentHead + 1) % USB_DTD_QUEUE_LEN;
+    t->sentCount--;
+    t->stalled = 0;  // host takes data again
+    // the host got to this transmit when it was queued, or when it finished the one before
+    uint64_t const taken = now - ((sent > t->lastDone) ? sent : t->lastDone);
+    learnAcceptTime(t, taken, now);
+    addHist(&t->hist[RELAY_PHASE_WIRE], taken);
+    t->lastDone = now;
+    if (parts == SENT_URGENT)
+    {
+      t->urgentInFlight = 0;
+      t->traffic.bytes += t->urgentEvents * 4;
+      addDelay(&t->delay[RELAY_CLASS_URGENT], now - t->urgentOldest, t->urgentEvents);
+      continue;
+    }
+    if (!parts)
+      continue;  // a piece of a packet
+    for (; parts; parts--)
+    {
+      addDelay(&t->delay[RELAY_CLASS_BULK], now - t->queue[t->qHead].time, 1);
+      addHist(&t->hist[RELAY_PHASE_WAIT], sent - t->queue[t->qHead].time);
+      t->traffic.packets++;
+      t->traffic.bytes += t->queue[t->qHead].len;
+      packetDone(t);
+    }
+    t->traffic.late += (now - t->packetTime >= usToTicks(SMON_LATE_TIME_US)) && (now - t->packetTime < usToTicks(SMON_STALE_TIME_US));
+    t->traffic.stale += (now - t->packetTime >= usToTicks(SMON_STALE_TIME_US));
+    SMON_monitorEvent(t->portNo, PACKET_DELIVERED);
+  }
+}
+
+// SysEx event packets : start or continuation, and the ends with 1..3 bytes
+static inline int isSysex(uint8_t const *const event)
+{
+  switch (event[0] & 0x0F)  // mask out cable number
+  {
+    case 0x04:  // start or continue
+    case 0x06:  // ends with two bytes
+    case 0x07:  // ends with three bytes
+      return 1;
+    case 0x05:  // single byte, end of SysEx or system common
+      return event[1] == 0xF7;
+    default:
+      return 0;
+  }
+}
+
+#if DROP_SYSEX_AWARE
+// note the SysEx data of a packet about to be dropped, DROP_SYSEX rescues the other events to the priority lane
+static inline void scanDropped(OP, Packet_t const *const p)
+{
+  uint32_t run;
+#if DROP_POLICY == DROP_SYSEX
+  unsigned n = 0;  // events to rescue
+#endif
+
+  for (uint32_t offset = 0; offset + 4 <= (uint32_t) p->len; offset += 4)
+  {
+    uint8_t *const event = packetData(p, offset, &run);
+    if (isSysex(event))
+    {
+      t->sysexCut   = 1;
+      t->sysexOpen  = ((event[0] & 0x0F) == 0x04);  // not ended within the dropped data
+      t->sysexCable = event[0] & 0xF0;
+    }
+#if DROP_POLICY == DROP_SYSEX
+    else
+      n++;
+#endif
+  }
+#if DROP_POLICY == DROP_SYSEX
+  // the packet is the oldest one, so its urgent events left in bulk are older than any behind it and newer than
+  // those in the lane, see takeUrgent. Rescued all or none, a note off lost while its note on got through would leave it hanging
+  if (t->urgentCount + n > URGENT_EVENTS)
+  {
+    t->drops.lostEvents += n;
+    return;
+  }
+  for (uint32_t offset = 0; offset + 4 <= (uint32_t) p->len; offset += 4)
+  {
+    uint8_t *const event = packetData(p, offset, &run);
+    if (!isSysex(event))
+      pushUrgent(t, event, p->time);
+  }
+  t->drops.keptEvents += n;
+#endif
+}
+
+// take the rest of a SysEx cut off out of a packet, up to its end or the start of a new one
+static inline void skipCutSysex(OP, Packet_t *const p)
+{
+  uint32_t kept = 0;
+  uint32_t i;
+  uint32_t run;
+
+  for (i = 0; i + 4 <= (uint32_t) p->len; i += 4)
+  {
+    uint8_t *const event = packetData(p, i, &run);
+    if (t->skipSysex && isSysex(event))
+    {
+      if (event[1] == 0xF0)
+        t->skipSysex = 0;  // a new one starts, keep it
+      else
+      {
+        t->drops.skippedEvents++;
+        if ((event[0] & 0x0F) != 0x04)
+          t->skipSysex = 0;  // that was the end
+        continue;
+      }
+    }
+    if (kept != i)
+      memcpy(packetData(p, kept, &run), event, 4);
+    kept += 4;
+  }
+  for (; i < (uint32_t) p->len; i++)  // trailing garbage is passed on as it is
+    *packetData(p, kept++, &run) = *packetData(p, i, &run);
+  p->len = kept;
+}
+
+// after dropping : terminate a SysEx that may have been cut off and discard what is left of it
+static inline void closeCutSysex(OP)
+{
+  if (!t->sysexCut)
+    return;
+#if DROP_POLICY == DROP_CLOSE_SYSEX
+  if (t->urgentCount < URGENT_EVENTS)
+  {  // goes out first, the receiver may already have got the start of the SysEx
+    uint8_t eox[4] = { t->sysexCable | 0x05, 0xF7, 0x00, 0x00 };
+    t->urgentHead  = (t->urgentHead + URGENT_EVENTS - 1) % URGENT_EVENTS;
+    t->urgentCount = t->urgentCount + 1;
+    memcpy(t->urgent[t->urgentHead].data, eox, 4);
+    t->urgent[t->urgentHead].time = ticker;
+    t->drops.closedSysex++;
+  }
+#endif
+  t->skipSysex = t->sysexOpen;
+  for (unsigned i = 0; i < t->qCount && t->skipSysex; i++)  // nothing is in transmit anymore
+    skipCutSysex(t, &t->queue[(t->qHead + i) % t->qSize]);
+  t->sysexCut  = 0;
+  t->sysexOpen = 0;
+}
+#endif
+
+// drop the oldest packet
+static inline void dropOldest(OP)
+{
+#if DROP_SYSEX_AWARE
+  scanDropped(t, &t->queue[t->qHead]);
+#endif
+  packetDone(t);
+  t->drops.oldest++;
+  monitorEvent(t, PACKET_DROPPED);
+}
+
+// transmits are gone, so are the packets queued to them
+static inline void dropSent(OP)
+{
+  t->dropped = 1;
+  t->stalled = 0;
+  for (unsigned n = queuedPackets(t); n; n--)  // including one partially sent
+    dropOldest(t);
+  t->qOffset = 0;
+  if (t->urgentInFlight)
+  {
+    t->drops.urgentEvents += t->urgentEvents;
+    monitorEvent(t, PACKET_DROPPED);
+  }
+  t->urgentInFlight = 0;
+  t->sentCount      = 0;
+}
+
+// transmit got stuck : flush it
+static inline void killSent(OP)
+{
+  USB_MIDI_KillTransmit(t->outgoingPortNo);
+  dropSent(t);
+}
+
+#if DROP_POLICY == DROP_NEWEST
+// keep the packet in transmit, dismiss the ones behind it. Their buffers are released in order later on
+static inline void dropNewest(OP)
+{
+  unsigned i = queuedPackets(t);
+
+  if (i == 0)
+    i = 1;  // oldest one could not be queued yet, keep it anyway
+  for (; i < t->qCount; i++)
+  {
+    Packet_t *const p = &t->queue[(t->qHead + i) % t->qSize];
+    if (p->len)
+    {
+      p->len = 0;
+      t->drops.newest++;
+      monitorEvent(t, PACKET_DROPPED);
+    }
+  }
+  t->stalled = 1;
+}
+#endif
+
+// outgoing host did not take a transfer in time, make room according to the drop policy
+static inline void dropOnTimeout(OP, uint64_t const now, int const dropHead)
 {
-  t->state = IDLE;
-  USB_MIDI_SuspendReceive(t->portNo, 0);  // keep receiver enabled
-  USB_MIDI_ClearReceive(t->portNo);
-
-  t->pData         = NULL;
-  t->len           = 0;
-  t->dropped       = 0;
-  t->packetTimeout = PACKET_TIMEOUT;
+  t->drops.timeouts++;
+  backOffTimeouts(t, now);
+#if DROP_POLICY == DROP_NEWEST
+  if (!t->stalled)
+  {  // give the host another timeout period for the transfer in flight
+    dropNewest(t);
+    t->packetTime = now;
+    t->urgentTime = now;
+    return;
+  }
+#endif
+  if (dropHead)
+    dropOldest(t);
+  killSent(t);  // transmit queue is flushed, so packets queued behind are gone as well
+#if DROP_SYSEX_AWARE
+  closeCutSysex(t);
+#endif
 }
 
 static inline void processTransfers(OP)
 {
-  if (!t->outgoingTransfer->online)
+  if (!outgoingOnline(t))
+    return;
+
+  uint64_t const now = ticker;
+
+  reapSent(t, now);
+#if CLOCK_REGEN_DELAY_US > 0
+  pushClocks(t, 0, now);
+#endif
+  sendUrgent(t, now);
+  if (t->urgentInFlight && timedOut(t, t->urgentTime, now) && mayDrop(t))
+  {  // urgent transfer is not taken by the host
+    dropOnTimeout(t, now, 0);
     return;
+  }
 
   if (t->state == IDLE)
     return;
 
-  uint64_t const now = ticker;
+#if USB_MIDI_CABLES > 1
+  sendCables(t, now);
+#else
+  Packet_t *const p = &t->queue[t->qHead];
 
   switch (t->state)
   {  // main sending state machine
@@ -101,56 +1228,144 @@ static inline void processTransfers(OP)
       break;
 
     case RECEIVED:  // packet was received, so start transmit process
-      t->packetTimeout = (!t->dropped) ? PACKET_TIMEOUT : PACKET_TIMEOUT_SHORT;
+      if (p->len == 0)
+      {
+        packetDone(t);
+        return;
+      }
+      if (t->coalesce && !coalesceReady(t, now))
+        break;  // wait for more packets to merge
+      t->packetTimeout = (!t->dropped) ? t->timeouts.timeoutTicks : t->timeouts.shortTicks;
       t->dropped       = 0;
       t->packetTime    = now;
       SMON_monitorEvent(t->portNo, PACKET_START);
       t->state = WAIT_FOR_XMIT_READY;
-      // fall-through is on purpose
+      // intentionally falls through
 
     case WAIT_FOR_XMIT_READY:
-      if (USB_MIDI_Send(t->outgoingPortNo, t->pData, t->len) < 0)
-        break;  /// could not start transfer now, try later
+      if (!t->qSent && !t->qOffset)  // not already queued behind its predecessor
+      {
+        if (t->coalesce)
+        {
+          if (sendCoalesced(t) < 0)
+            break;  /// could not start transfer now, try later
+        }
+        else
+        {
+          if (sendBulk(t) < 0)
+            break;  /// could not start transfer now, try later
+        }
+      }
       t->state = WAIT_FOR_XMIT_DONE;
-      break;
+      // intentionally falls through
 
-    case WAIT_FOR_XMIT_DONE:
-      if (USB_MIDI_BytesToSend(t->outgoingPortNo) > 0)
-        break;  // still sending...
-      t->state = IDLE;
-      USB_MIDI_SuspendReceive(t->portNo, 0);  // re-enable receiver
-      USB_MIDI_primeReceive(t->portNo);
-      SMON_monitorEvent(t->portNo, PACKET_DELIVERED);
+    case WAIT_FOR_XMIT_DONE:  // reapSent() finishes it
+      sendFollowing(t);
       break;
   }
+#endif
 
   if (t->state >= WAIT_FOR_XMIT_READY)
   {
-    if ((now - t->packetTime) > t->packetTimeout)  // packet could not be submitted
+    if (timedOut(t, t->packetTime, now) && mayDrop(t))  // packet could not be submitted
     {
-      t->dropped = 1;
-      USB_MIDI_KillTransmit(t->outgoingPortNo);
-      t->state = IDLE;
-      USB_MIDI_SuspendReceive(t->portNo, 0);  // re-enable receiver
-      USB_MIDI_primeReceive(t->portNo);
-      SMON_monitorEvent(t->portNo, PACKET_DROPPED);
+      dropOnTimeout(t, now, !queuedPackets(t));  // head packet is dropped as well when not even queued
       return;
     }
   }
 }
 
+#ifdef FAST_LANE_ENDPOINTS
+// queue the collected fast lane data when the previous transmit is done
+static inline void sendFast(OP, uint64_t const now)
+{
+  uint8_t const  port = t->portNo ^ 1;
+  uint32_t const fill = t->fastFill[t->fastCollect];
+
+  if (t->fastInFlight || !fill || !packetTransfer[port].online)
+    return;
+  if (USB_MIDI_SendFast(port, fastBuffer[t->portNo][t->fastCollect], fill) < 0)
+    return;  // no room in the transmit queue, try later
+  shapeTake(port, fill);
+  t->fastInFlight = 1;
+  t->fastTime     = now;
+  t->fastCollect ^= 1;
+  t->fastFill[t->fastCollect] = 0;
+}
+
+// move received data into the collecting half as long as there is room, a half sent off makes room again
+static void collectFast(OP, uint64_t const now)
+{
+  sendFast(t, now);
+  while (t->fastWaiting)
+  {
+    FastWait_t *const w    = &t->fastWait[0];
+    uint32_t *const   fill = &t->fastFill[t->fastCollect];
+    uint32_t          n    = FAST_LANE_SIZE - *fill;
+
+    if (!n)
+      return;  // both halves taken, the host stays NAKed
+    if (n > w->len)
+      n = w->len;
+    memcpy(&fastBuffer[t->portNo][t->fastCollect][*fill], w->buff, n);
+    *fill += n;
+    w->buff += n;
+    w->len -= n;
+    if (!w->len)
+    {
+      t->fastWaiting--;
+      for (unsigned i = 0; i < t->fastWaiting; i++)
+        t->fastWait[i] = t->fastWait[i + 1];
+      USB_MIDI_ReleaseFastReceive(t->portNo);
+    }
+    sendFast(t, now);
+  }
+}
+
+// fast lane transmit timed out : flush it, its data is lost
+static inline void checkFast(OP, uint64_t const now)
+{
+  if (t->fastInFlight && now - t->fastTime > FAST_LANE_TIMEOUT)
+  {
+    USB_MIDI_KillFastTransmit(t->portNo ^ 1);
+    t->drops.fastEvents += t->fastFill[t->fastCollect ^ 1] / 4;
+    t->fastInFlight = 0;
+  }
+  if (!packetTransfer[t->portNo ^ 1].online)
+    while (t->fastWaiting)
+    {  // nobody to take it
+      t->drops.fastEvents += t->fastWait[--t->fastWaiting].len / 4;
+      USB_MIDI_ReleaseFastReceive(t->portNo);
+    }
+  collectFast(t, now);
+}
+#endif
+
 static inline void checkPortStatus(OP)
 {
   if (USB_GetError(t->portNo))
-  {
-    __disable_irq();
+  {  // restart the faulty controller only, the other port stays configured and keeps its packets
+    killSent(t);  // transmits on the other port carry data of this port's receive buffers
+    if (sender[t->portNo])
+    {  // transmits queued on this port are lost, the packets behind wait until it is back
+      dropSent(sender[t->portNo]);
+      sender[t->portNo]->dropped = 0;
+    }
+    if (t->echo)
+    {  // the host has to ask for it again
+      t->echo = 0;
+      route();
+    }
+    stopGenerator(t->portNo);
     USB_MIDI_DeInit(t->portNo);
-    USB_MIDI_DeInit(t->outgoingPortNo);
-    MIDI_Relay_Init();
-    __enable_irq();
+    packetTransferReset(t);
+    USB_MIDI_Init(t->portNo);
+    t->recovery.faults++;
+    t->recovering = 1;
+    t->faultTime  = ticker;
     return;
   }
-  uint32_t online  = USB_MIDI_IsConfigured(t->portNo);
+  int      online  = USB_MIDI_IsConfigured(t->portNo);
   int      powered = (t->portNo == 0) ? USB0_VBUS : USB1_VBUS;
 
   if (t->first)
@@ -168,9 +1383,24 @@ static inline void checkPortStatus(OP)
       USB_MIDI_SuspendReceive(t->portNo, 0);
       USB_MIDI_primeReceive(t->portNo);
       SMON_monitorEvent(t->portNo, ONLINE);
+      if (t->recovering)
+      {
+        uint32_t const ticks = ticker - t->faultTime;
+        t->recovering        = 0;
+        t->recovery.recovered++;
+        t->recovery.lastTicks = ticks;
+        if (ticks > t->recovery.maxTicks)
+          t->recovery.maxTicks = ticks;
+      }
     }
     else
     {
+      if (t->echo)
+      {  // nothing is in transmit on the port anymore
+        t->echo = 0;
+        route();
+      }
+      stopGenerator(t->portNo);
       packetTransferReset(t);
       SMON_monitorEvent(t->portNo, OFFLINE);
     }
@@ -186,58 +1416,651 @@ static inline void checkPortStatus(OP)
   }
 }
 
-void MIDI_Relay_ProcessFast(void)
+/******************************************************************************/
+/** @brief		Periodic work of the relay, call from the SysTick handler
+    @details	Runs at the priority of the USB interrupts, so it is never
+				interleaved with them. Does nothing until MIDI_Relay_Init() has
+				handed the relay over.
+*******************************************************************************/
+void MIDI_Relay_Tick(void)
 {
+  if (!relayRunning)
+    return;
+
   checkPortStatus(&packetTransfer[0]);
   checkPortStatus(&packetTransfer[1]);
 
+  // collect receive buffers the hosts left partially filled
+  if (packetTransfer[0].online)
+    USB_MIDI_CheckReceive(0);
+  if (packetTransfer[1].online)
+    USB_MIDI_CheckReceive(1);
+
+  // transfers are driven by the USB interrupts, here only the timers are checked
   processTransfers(&packetTransfer[0]);
   processTransfers(&packetTransfer[1]);
+  generate(ticker);
+#ifdef FAST_LANE_ENDPOINTS
+  checkFast(&packetTransfer[0], ticker);
+  checkFast(&packetTransfer[1], ticker);
+#endif
+  shapeTick(0);
+  shapeTick(1);
 }
 
 // ------------------------------------------------------------
 
+// system real-time and channel messages go to the priority lane
+static inline int isUrgent(uint8_t const *const event)
+{
+  switch (event[0] & 0x0F)  // mask out cable number
+  {
+    case 0x08:  // note off
+    case 0x09:  // note on
+    case 0x0A:  // poly pressure
+    case 0x0B:  // control change
+    case 0x0C:  // program change
+    case 0x0D:  // channel pressure
+    case 0x0E:  // pitch bend
+      return 1;
+    case 0x0F:  // single byte
+      return event[1] >= 0xF8;
+    default:
+      return 0;
+  }
+}
+
+// move urgent event packets out of a received buffer into the priority lane, returns the remaining length.
+// Once one is left in bulk for want of room, the later ones stay there as well until it is sent, so none
+// overtakes another. Regenerated clock ticks are the exception, they are retimed anyway
+static inline uint32_t takeUrgent(OP, uint8_t *const buff, uint32_t const len, int *const pLeft)
+{
+  uint64_t const now  = ticker;
+  uint32_t       kept = 0;
+  uint32_t       i;
+
+  for (i = 0; i + 4 <= len; i += 4)
+  {
+#if CLOCK_REGEN_DELAY_US > 0
+    if (isClock(&buff[i]))
+    {  // taken out here, and sent on when the filter has it due
+      if (outgoingOnline(t))
+        CLOCK_Input(&t->clock, now);
+      t->clockCable = buff[i] & 0xF0;
+      continue;
+    }
+    if (isStop(&buff[i]))  // ticks still waiting go out before the Stop
+      pushClocks(t, 1, now);
+#endif
+    int const urgent = isUrgent(&buff[i]);
+    if (urgent && !t->urgentBulk && !*pLeft && t->urgentCount < URGENT_EVENTS)
+      pushUrgent(t, &buff[i], now);
+    else
+    {
+      *pLeft |= urgent;
+      if (kept != i)
+        memcpy(&buff[kept], &buff[i], 4);
+      kept += 4;
+    }
+  }
+  for (; i < len; i++)  // trailing garbage is passed on as it is
+    buff[kept++] = buff[i];
+  return kept;
+}
+
+#if THIN_QUEUE_DEPTH > 0
+#define THIN_KEYS (256)  // distinct values one thinning pass keeps track of, power of 2
+
+static uint32_t thinKeys[THIN_KEYS] __attribute__((section(".noinit.$RamAHB32")));  // shared, passes never overlap
+static unsigned thinUsed;
+
+// event that only sets a value, so only the latest one per key counts : cable, channel, and controller or note
+static inline uint32_t thinKey(uint8_t const *const event)
+{
+  uint32_t const key = ((uint32_t) event[0] << 16) | ((uint32_t) event[1] << 8);
+
+  if ((event[1] >> 4) != (event[0] & 0x0F))
+    return 0;  // malformed
+  switch (event[0] & 0x0F)
+  {
+    case 0x0A:  // poly pressure
+      return key | event[2];
+    case 0x0B:  // control change, except bank select, (N)RPN data entry and the channel mode messages
+      if (event[2] == 0 || event[2] == 6 || event[2] == 32 || event[2] == 38 || (event[2] >= 96 && event[2] <= 101) || event[2] >= 120)
+        return 0;
+      return key | event[2];
+    case 0x0D:  // channel pressure
+    case 0x0E:  // pitch bend
+      return key;
+    default:
+      return 0;
+  }
+}
+
+// returns 1 if the key was met before in this pass, otherwise notes it
+static inline int thinSeen(uint32_t const key)
+{
+  unsigned i = (key ^ (key >> 8) ^ (key >> 16)) % THIN_KEYS;
+
+  while (thinKeys[i])
+  {
+    if (thinKeys[i] == key)
+      return 1;
+    i = (i + 1) % THIN_KEYS;
+  }
+  if (thinUsed < THIN_KEYS * 3 / 4)  // when full, further values are kept
+  {
+    thinKeys[i] = key;
+    thinUsed++;
+  }
+  return 0;
+}
+
+// events are checked newest first, a value is superfluous when a later one for the same key was seen
+static inline int thinOut(OP, uint8_t const *const event)
+{
+  uint32_t key;
+
+  if ((event[0] & 0x0F) == 0x0F && event[1] == 0xFE)
+  {
+    t->drops.thinnedSensing++;
+    return 1;
+  }
+  key = thinKey(event);
+  if (key && thinSeen(key))
+  {
+    t->drops.thinnedValues++;
+    return 1;
+  }
+  return 0;
+}
+
+static inline void thinPacket(OP, Packet_t *const p)
+{
+  uint8_t        gone[USB_MIDI_RX_SIZE_HS / 4 / 8];
+  uint32_t const n    = (uint32_t) p->len / 4;
+  uint32_t       kept = 0;
+  uint32_t       i;
+  uint32_t       run;
+  int            any = 0;
+
+  memset(gone, 0, sizeof gone);
+  for (i = n; i--;)
+    if (thinOut(t, packetData(p, i * 4, &run)))
+    {
+      gone[i / 8] |= 1u << (i % 8);
+      any = 1;
+    }
+  if (!any)
+    return;
+  for (i = 0; i < n; i++)
+  {
+    if (gone[i / 8] & (1u << (i % 8)))
+      continue;
+    if (kept != i * 4)
+      memcpy(packetData(p, kept, &run), packetData(p, i * 4, &run), 4);
+    kept += 4;
+  }
+  for (i *= 4; i < (uint32_t) p->len; i++)  // trailing garbage is passed on as it is
+    *packetData(p, kept++, &run) = *packetData(p, i, &run);
+  p->len = kept;
+}
+
+// urgent events are sent ahead of the packets, so they are checked last
+static inline void thinUrgent(OP)
+{
+  unsigned const n    = t->urgentCount;
+  unsigned       kept = 0;
+
+  for (unsigned i = n; i--;)
+  {
+    Event_t *const e = &t->urgent[(t->urgentHead + i) % URGENT_EVENTS];
+    if (thinOut(t, e->data))
+      continue;
+    kept++;
+    Event_t *const to = &t->urgent[(t->urgentHead + n - kept) % URGENT_EVENTS];
+    if (to != e)
+      *to = *e;
+  }
+  t->urgentHead  = (t->urgentHead + n - kept) % URGENT_EVENTS;
+  t->urgentCount = kept;
+}
+
+// outgoing host falls behind : thin out everything not in transmit yet, a received packet first.
+// What the receiving host ends up with is unchanged, only the steps on the way are skipped.
+static inline void thinCongested(OP, Packet_t *const incoming)
+{
+  unsigned const first = queuedPackets(t);
+
+  memset(thinKeys, 0, sizeof thinKeys);
+  thinUsed = 0;
+  thinPacket(t, incoming);
+  for (unsigned i = t->qCount; i-- > first;)
+    thinPacket(t, &t->queue[(t->qHead + i) % t->qSize]);
+  thinUrgent(t);
+}
+#endif
+
+#ifdef LOSSLESS_BUFFERING
+// extend the newest packet when data was stored right behind it in the arena and it is not in transmit yet,
+// so small packets do not use up the queue
+static inline int mergeStored(OP, uint32_t const len, uint32_t const rxLen)
+{
+  if (!t->qCount)
+    return 0;
+
+  unsigned const  last = t->qCount - 1;
+  Packet_t *const p    = &t->queue[(t->qHead + last) % t->qSize];
+
+  if (p->chunk == ARENA_NONE || last < queuedPackets(t))
+    return 0;
+  if (p->len != p->stored || (p->offset + p->stored) % ARENA_ALIGN || p->stored + len > USB_MIDI_RX_SIZE_HS)
+    return 0;  // data was taken out, or does not fit
+  p->len += len;
+  p->stored += len;
+  p->rxLen = rxLen;
+  return 1;
+}
+#endif
+
 static inline void onReceive(OP, uint8_t *buff, uint32_t len)
 {
-  if (len == 0)
-    return;  // empty packet will not cause any action and is simply ignored
+  if (t->qCount >= t->qSize)
+  {  // we should never receive a packet when all buffers are in use. Make room at the cost of the oldest ones
+    t->receive.unexpected++;
+    if (queuedPackets(t))
+      killSent(t);
+    else
+      dropOldest(t);
+  }
 
-  if (!t->online)
-    return;  // just in case incoming port went offline and we still got an interrupt
+  if (len > USB_MIDI_RX_SIZE_HS)
+  {  // we should never ever receive a transfer longer than the largest receive buffer, its data is not trusted
+    t->receive.oversize++;
+    monitorEvent(t, PACKET_DROPPED);
+    len = 0;
+  }
+
+  if (len)
+    len = VALIDATE_Apply(buff, len, USB_MIDI_CABLES, &t->receive.malformedEvents);
+
+  if (!t->online)  // just in case incoming port went offline and we still got an interrupt
+    len = 0;
+#ifndef LOSSLESS_BUFFERING
+  else if (!outgoingOnline(t))  // outgoing port is offline, mark packet as dismissed
+  {
+    monitorEvent(t, DROPPED_INCOMING);
+    len = 0;
+  }
+#endif
+
+#if DROP_POLICY == DROP_NEWEST
+  if (len && t->stalled)  // outgoing host is stuck, dismiss anything new
+  {
+    t->drops.newest++;
+    monitorEvent(t, PACKET_DROPPED);
+    len = 0;
+  }
+#endif
+
+  uint32_t const rxLen = len;
+  int            left  = 0;  // urgent events left in bulk
+#if FILTER_ACTIVE
+  if (len)
+  {
+    uint32_t const filtered = FILTER_Apply(buff, len);
+    t->drops.filteredEvents += (len - filtered) / 4;
+    len = filtered;
+  }
+#endif
+  if (len)
+    len = takeUrgent(t, buff, len, &left);
+#ifdef PERF_TIMESTAMPS
+  if (len)
+    STAMP_Apply(buff, len, PERF_FIELD_INGRESS, TICKER_usecs());
+#endif
+#if DROP_SYSEX_AWARE
+  if (len && t->skipSysex)
+  {
+    Packet_t p = { .pData = buff, .len = len, .chunk = ARENA_NONE };
+    skipCutSysex(t, &p);
+    len = p.len;
+  }
+#endif
+#if THIN_QUEUE_DEPTH > 0
+  if (outgoingOnline(t) && (t->qCount >= THIN_QUEUE_DEPTH || t->urgentCount >= URGENT_EVENTS || left))
+  {
+    Packet_t p = { .pData = buff, .len = len, .chunk = ARENA_NONE };
+    thinCongested(t, &p);
+    len = p.len;
+  }
+#endif
+
+  uint8_t  chunk  = ARENA_NONE;
+  uint16_t offset = 0;
+#ifdef LOSSLESS_BUFFERING
+  // buffers are released in the order they were received, so only when none is held
+  if (len && !t->qHeld && t->qCount < ARENA_CHUNKS)
+    chunk = ARENA_Store(t->portNo, buff, len, &offset);
+  if (len && chunk == ARENA_NONE && !outgoingOnline(t))  // outgoing port is offline and no room to keep it
+  {
+    monitorEvent(t, DROPPED_INCOMING);
+    len = 0;
+  }
+#endif
+
+  if (chunk != ARENA_NONE || (len == 0 && !t->qHeld))
+  {  // data was copied, or there is none and no buffer is held before this one : return it right away
+    USB_MIDI_ReleaseReceive(t->portNo);
+#ifdef LOSSLESS_BUFFERING
+    if (chunk != ARENA_NONE && mergeStored(t, len, rxLen))
+    {
+      if (left)
+        t->urgentBulk = t->qCount;  // merged into the newest packet
+      len = 0;
+    }
+#endif
+    if (len == 0)
+    {
+      processTransfers(t);  // for urgent events taken out
+      return;
+    }
+  }
+  else
+    t->qHeld = t->qHeld + 1;
+
+  // append packet
+  t->queue[(t->qHead + t->qCount) % t->qSize] = (Packet_t){ .pData = buff, .len = len, .rxLen = rxLen, .time = ticker, .chunk = chunk, .offset = offset, .stored = (chunk != ARENA_NONE) ? len : 0 };
+  t->qCount                                   = t->qCount + 1;
+  if (left)
+    t->urgentBulk = t->qCount;
+  if (t->state == IDLE)
+    t->state = RECEIVED;
+  processTransfers(t);
+}
 
-  if (len > 512)  // we should never ever receive a packet longer than the fixed(!) 512Bytes HS bulk size max
-    DisplayErrorAndHalt(E_USB_PACKET_SIZE);
+// echo mode on or off : transmits in flight would end up on the wrong port, so both ports are flushed
+static inline void setEcho(OP, int const on)
+{
+  if (t->echo == on)
+    return;
+  for (unsigned p = 0; p < 2; p++)
+  {
+    if (packetTransfer[p].online)
+      USB_MIDI_KillTransmit(p);
+    dropSent(&packetTransfer[p]);
+  }
+  t->echo = on;
+  route();
+  processTransfers(&packetTransfer[0]);
+  processTransfers(&packetTransfer[1]);
+}
+
+// bytes of a transfer up to and including the event packet ending the SysEx it starts with, 0 --> not ended in it
+static inline uint32_t sysexEnd(uint8_t const *const msg, uint32_t const len)
+{
+  for (uint32_t end = 0; end + 4 <= len; end += 4)
+    if ((msg[end] & 0x0F) >= 0x05 && (msg[end] & 0x0F) <= 0x07)
+      return end + 4;
+  return 0;
+}
+
+// send a ping message back, ahead of any bulk data queued for the port
+static inline void ping(OP, uint8_t *const msg, uint32_t const len)
+{
+  mkOP(s) = sender[t->portNo];
+
+  if (!s || !len || s->urgentCount + len / 4 > URGENT_EVENTS)
+    return;  // incomplete, or no room : the host's ping times out
+  for (uint32_t i = 0; i < len; i += 4)
+    pushUrgent(s, &msg[i], ticker);
+  processTransfers(s);
+}
+
+// plain SysEx bytes into USB-MIDI event packets
+static inline uint32_t packSysex(uint8_t const *const src, uint32_t const len, uint8_t const cable, uint8_t *const dest)
+{
+  uint32_t n = 0;
 
-  if (!t->outgoingTransfer->online)  // outgoing port is offline, mark packet as dismissed
+  for (uint32_t i = 0; i < len; i += 3, n += 4)
   {
-    SMON_monitorEvent(t->portNo, DROPPED_INCOMING);
+    uint32_t const left = len - i;
+    dest[n]             = cable | ((left > 3) ? 0x04 : 0x04 + left);  // start or continue, or ends with 1..3 bytes
+    dest[n + 1]         = src[i];
+    dest[n + 2]         = (left > 1) ? src[i + 1] : 0;
+    dest[n + 3]         = (left > 2) ? src[i + 2] : 0;
+  }
+  return n;
+}
+
+// send a device control reply back, ahead of any bulk data queued for the port : the query's command and
+// parameters, then the values 8-to-7 encoded
+static inline void reply(OP, uint8_t const cable, uint8_t const cmd, uint8_t const *const param, uint32_t const nParam,
+                         void const *const values, uint32_t const size)
+{
+  static uint8_t encoded[(REPLY_MAX_SIZE * 8 + 6) / 7 + 2];
+  static uint8_t msg[sizeof NLMB_DevCtlSignature + 2 + REPLY_MAX_PARAMS + sizeof encoded];
+  static uint8_t events[(sizeof msg + 2) / 3 * 4];
+  mkOP(s)    = sender[t->portNo];
+  uint32_t n = sizeof NLMB_DevCtlSignature;
+
+  memcpy(msg, (void *) NLMB_DevCtlSignature, n);
+  msg[n++] = cmd;
+  msg[n++] = 0x01;
+  for (uint32_t i = 0; i < nParam; i++)
+    msg[n++] = param[i];
+  uint32_t const len = MIDI_encodeSysex((uint8_t const *) values, size, encoded);
+  memcpy(&msg[n], &encoded[1], len - 1);  // without its F0
+  n = packSysex(msg, n + len - 1, cable, events);
+  if (!s || s->urgentCount + n / 4 > URGENT_EVENTS)
+    return;  // no room : the host's query times out
+  for (uint32_t i = 0; i < n; i += 4)
+    pushUrgent(s, &events[i], ticker);
+  processTransfers(s);
+}
+
+// the counters of both directions, CMD_STATS
+static inline void replyStats(OP, uint8_t const cable)
+{
+  static uint32_t values[2][STATS_FIELDS];
+
+  for (unsigned p = 0; p < 2; p++)
+  {
+    PacketTransfer_t const *const d = &packetTransfer[p];
+    uint32_t *const               v = values[p];
+
+    v[STATS_PACKETS]          = d->traffic.packets;
+    v[STATS_BYTES]            = d->traffic.bytes;
+    v[STATS_URGENT_EVENTS]    = d->delay[RELAY_CLASS_URGENT].count;
+    v[STATS_DROPPED]          = d->traffic.dropped;
+    v[STATS_DROPPED_INCOMING] = d->traffic.droppedIncoming;
+    v[STATS_LATE]             = d->traffic.late;
+    v[STATS_STALE]            = d->traffic.stale;
+    v[STATS_TIMEOUTS]         = d->drops.timeouts;
+    v[STATS_MALFORMED]        = d->receive.malformedEvents;
+    v[STATS_MAX_DWELL_US]     = d->delay[RELAY_CLASS_BULK].maxTicks * 125;
+    v[STATS_MAX_URGENT_US]    = d->delay[RELAY_CLASS_URGENT].maxTicks * 125;
+    v[STATS_USB_ERRORS]       = d->recovery.faults;
+    v[STATS_SHAPER_HOLDS]     = shaper[p].stats.holds;
+    v[STATS_SHAPER_HELD_US]   = shaper[p].stats.throttledTicks * 125;
+    v[STATS_ARENA_PEAK]       = ARENA_GetStats(p)->highWater * ARENA_CHUNK_SIZE;
+    v[STATS_ARENA_FAILED]     = ARENA_GetStats(p)->failed;
+    v[STATS_ARENA_TOTAL_PEAK] = ARENA_GetTotalStats()->highWater * ARENA_CHUNK_SIZE;
+    v[STATS_RECOVERY_LAST_US] = d->recovery.lastTicks * 125;
+    v[STATS_RECOVERY_MAX_US]  = d->recovery.maxTicks * 125;
+  }
+  reply(t, cable, CMD_STATS_L, NULL, 0, values, sizeof values);
+}
+
+// a latency histogram, CMD_HISTOGRAM : port, phase and reset flag
+static inline void replyHistogram(OP, uint8_t const cable, uint8_t const *const param)
+{
+  if (param[0] > 1 || param[1] >= RELAY_PHASES)
     return;
+
+  RelayHistogram_t *const h = &packetTransfer[param[0]].hist[param[1]];
+  reply(t, cable, CMD_HISTOGRAM_L, param, 3, h->bucket, sizeof h->bucket);
+  if (param[2] == 1)
+    *h = (RelayHistogram_t){ 0 };
+}
+
+// test traffic on or off for the port it is received on : the port's transmits in flight are flushed,
+// those of the relay as well as the generator's, and the relay does not send on it while generating
+static inline void setGenerator(OP, int const on, uint32_t const blockSize, uint32_t const rate)
+{
+  if (generator.size && packetTransfer[genPort].online)
+    USB_MIDI_KillTransmit(genPort);
+  if (on && sender[t->portNo])
+  {
+    USB_MIDI_KillTransmit(t->portNo);
+    dropSent(sender[t->portNo]);
   }
+  if (on)
+    GEN_Start(&generator, blockSize, rate, ticker);
+  else
+    GEN_Stop(&generator);
+  genPort = t->portNo;
+  genNext = 0;
+  route();
+  processTransfers(&packetTransfer[0]);
+  processTransfers(&packetTransfer[1]);
+  generate(ticker);
+}
+
+// device control commands taken while relaying, when a received transfer starts with them. Only the command's
+// SysEx is taken, the events behind it in the same transfer are relayed as usual. One not ended in the
+// transfer takes all of it
+static inline int devCtl(OP, uint8_t *const buff, uint32_t const len)
+{
+  uint8_t *data    = buff;
+  uint32_t dataLen = len;
+  uint8_t  mode    = 0;
 
-  if (t->state != IDLE)  // we should never receive a packet when not IDLE
-    DisplayErrorAndHalt(E_USB_UNEXPECTED_PACKET);
+  if (!t->online)
+    return 0;
+  uint16_t const cmd = DEVCTL_isDeviceControlMsg(&data, &dataLen);  // nearly every transfer fails on the signature
+  if (!cmd)
+    return 0;
+  uint32_t const ended = sysexEnd(buff, len);  // the signature is not ended, so data is within the message
+  uint32_t const end   = ended ? ended : len;
+  dataLen              = end - (uint32_t)(data - buff);
+  switch (cmd)
+  {
+    case CMD_ECHO:
+      DEVCTL_getData(data, dataLen, &mode, 1);
+      setEcho(t, mode == 1);
+      break;
+    case CMD_PING:
+      ping(t, buff, ended);
+      break;
+    case CMD_GENERATE:
+    {
+      uint8_t param[5] = { 0 };  // on, block size and rate, 14 bits each
+      DEVCTL_getData(data, dataLen, param, sizeof param);
+      setGenerator(t, param[0] == 1, param[1] | (param[2] << 7), param[3] | (param[4] << 7));
+      break;
+    }
+    case CMD_SHAPE:
+    {
+      uint8_t param[5] = { 0 };  // rate, 21 bits, and burst size, 14 bits
+      DEVCTL_getData(data, dataLen, param, sizeof param);
+      shapeSet(t->portNo, param[0] | (param[1] << 7) | (param[2] << 14), param[3] | (param[4] << 7));
+      break;
+    }
+    case CMD_STATS:
+      replyStats(t, buff[0] & 0xF0);
+      break;
+    case CMD_HISTOGRAM:
+    {
+      uint8_t param[3] = { 0 };  // port, phase, reset
+      DEVCTL_getData(data, dataLen, param, sizeof param);
+      replyHistogram(t, buff[0] & 0xF0, param);
+      break;
+    }
+    default:
+      return 0;
+  }
+  onReceive(t, buff + end, len - end);  // the rest, or nothing but to release the buffer in order
+  return 1;
+}
 
-  // setup packet transfer data ...
-  t->pData = buff;
-  t->len   = len;
-  t->state = RECEIVED;
-  // ... and block receiver until transmit finished/failed
-  USB_MIDI_SuspendReceive(t->portNo, 1);
+static void Send_IRQ_Callback(uint8_t const port)
+{
+  if (sender[port])
+    processTransfers(sender[port]);  // the direction going out on this port
+  else if (generator.size && genPort == port)
+    generate(ticker);
 }
 
 static void Receive_IRQ_Callback_0(uint8_t const port, uint8_t *buff, uint32_t len)
 {
-  onReceive(&packetTransfer[0], buff, len);
+  (void) port;
+  if (!devCtl(&packetTransfer[0], buff, len))
+    onReceive(&packetTransfer[0], buff, len);
 }
 
 static void Receive_IRQ_Callback_1(uint8_t const port, uint8_t *buff, uint32_t len)
 {
-  onReceive(&packetTransfer[1], buff, len);
+  (void) port;
+  if (!devCtl(&packetTransfer[1], buff, len))
+    onReceive(&packetTransfer[1], buff, len);
+}
+
+#ifdef FAST_LANE_ENDPOINTS
+// fast lane data is collected as far as there is room, whole event packets only
+static void Fast_Receive_IRQ_Callback(uint8_t const port, uint8_t *buff, uint32_t len)
+{
+  mkOP(t)            = &packetTransfer[port];
+  uint64_t const now = ticker;
+
+  len &= ~3u;
+  if (!t->online)
+  {
+    USB_MIDI_ReleaseFastReceive(port);
+    return;
+  }
+  len = VALIDATE_Apply(buff, len, 1, &t->receive.malformedEvents);
+#if FILTER_ACTIVE
+  if (len)
+  {
+    uint32_t const filtered = FILTER_Apply(buff, len);
+    t->drops.filteredEvents += (len - filtered) / 4;
+    len = filtered;
+  }
+#endif
+  if (!packetTransfer[port ^ 1].online)
+  {
+    t->drops.fastEvents += len / 4;
+    len = 0;
+  }
+  if (!len)
+  {
+    USB_MIDI_ReleaseFastReceive(port);
+    return;
+  }
+  t->fastWait[t->fastWaiting++] = (FastWait_t){ buff, len };
+  collectFast(t, now);
+}
+
+// a fast lane transmit going out on the port has finished
+static void Fast_Send_IRQ_Callback(uint8_t const port)
+{
+  mkOP(t)            = &packetTransfer[port ^ 1];
+  uint64_t const now = ticker;
+
+  if (!t->fastInFlight)
+    return;
+  addHist(&t->hist[RELAY_PHASE_WIRE], now - t->fastTime);
+  t->traffic.bytes += t->fastFill[t->fastCollect ^ 1];
+  t->fastInFlight = 0;
+  collectFast(t, now);
 }
+#endif
 
 static void Receive_IRQ_DevCtlCallback(uint8_t const port, uint8_t *buff, uint32_t len)
 {
   DEVCTL_processMsg(buff, len);
+  USB_MIDI_ReleaseReceive(port);
 }
 
 static void Receive_IRQ_FirstCallback(uint8_t const port, uint8_t *buff, uint32_t len)
@@ -245,7 +2068,9 @@ static void Receive_IRQ_FirstCallback(uint8_t const port, uint8_t *buff, uint32_
   USB_MIDI_Config(0, Receive_IRQ_Callback_0);
   USB_MIDI_Config(1, Receive_IRQ_Callback_1);
 
-  uint16_t cmd = DEVCTL_isDeviceControlMsg(&buff, &len);
+  uint8_t *msg    = buff;
+  uint32_t msgLen = len;
+  uint16_t cmd    = DEVCTL_isDeviceControlMsg(&msg, &msgLen);
   if (cmd == CMD_GET_AND_PROG)
   {
     USB_MIDI_DeInit(port ^ 1);
@@ -253,26 +2078,86 @@ static void Receive_IRQ_FirstCallback(uint8_t const port, uint8_t *buff, uint32_
     USB_MIDI_Config(port, Receive_IRQ_DevCtlCallback);
 
     DEVCTL_init(port);
-    DEVCTL_processMsg(buff, len);
+    DEVCTL_processMsg(msg, msgLen);
+    USB_MIDI_ReleaseReceive(port);
     return;
   }
 
   if (cmd == CMD_LED_TEST)
   {
     SMON_monitorEvent(0, LED_TEST);
+    USB_MIDI_ReleaseReceive(port);
     return;
   }
 
-  onReceive(&packetTransfer[port], buff, len);
+  if (port == 0)
+    Receive_IRQ_Callback_0(port, buff, len);
+  else
+    Receive_IRQ_Callback_1(port, buff, len);
+}
+
+/******************************************************************************/
+/** @brief		Get the counters of the drop policy
+    @param[in]	port	incoming port of the direction
+    @return		statistics, see DROP_POLICY for which of them count
+*******************************************************************************/
+RelayDropStats_t const *MIDI_Relay_GetDropStats(uint8_t const port)
+{
+  return &packetTransfer[port].drops;
+}
+
+/******************************************************************************/
+/** @brief		Get the statistics of the restarts after USB errors
+    @param[in]	port	USB port
+    @return		statistics, times are from the error until the host has
+				configured the port again
+*******************************************************************************/
+RelayRecoveryStats_t const *MIDI_Relay_GetRecoveryStats(uint8_t const port)
+{
+  return &packetTransfer[port].recovery;
+}
+
+/******************************************************************************/
+/** @brief		Get the counters of received data that was not as expected
+    @param[in]	port	incoming port of the direction
+    @return		statistics, transfers and event packets that used to halt
+				the bridge or were passed on unchecked
+*******************************************************************************/
+RelayReceiveStats_t const *MIDI_Relay_GetReceiveStats(uint8_t const port)
+{
+  return &packetTransfer[port].receive;
+}
+
+/******************************************************************************/
+/** @brief		Get the traffic counters, see CMD_STATS
+    @param[in]	port	incoming port of the direction
+    @return		statistics
+*******************************************************************************/
+RelayTrafficStats_t const *MIDI_Relay_GetTrafficStats(uint8_t const port)
+{
+  return &packetTransfer[port].traffic;
 }
 
 void MIDI_Relay_Init(void)
 {
+  relayRunning = 0;
+  NVIC_SetPriority(USB0_IRQn, RELAY_IRQ_PRIORITY);
+  NVIC_SetPriority(USB1_IRQn, RELAY_IRQ_PRIORITY);
+  NVIC_SetPriority(SysTick_IRQn, RELAY_IRQ_PRIORITY);
+  ARENA_Init();
   packetTransferReset(&packetTransfer[0]);
   packetTransferReset(&packetTransfer[1]);
   USB_MIDI_Config(0, Receive_IRQ_FirstCallback);
   USB_MIDI_Config(1, Receive_IRQ_FirstCallback);
+  USB_MIDI_ConfigSend(0, Send_IRQ_Callback);
+  USB_MIDI_ConfigSend(1, Send_IRQ_Callback);
+#ifdef FAST_LANE_ENDPOINTS
+  USB_MIDI_ConfigFast(0, Fast_Receive_IRQ_Callback, Fast_Send_IRQ_Callback);
+  USB_MIDI_ConfigFast(1, Fast_Receive_IRQ_Callback, Fast_Send_IRQ_Callback);
+#endif
   USB_MIDI_SetupDescriptors();
   USB_MIDI_Init(0);
   USB_MIDI_Init(1);
+  __DMB();  // all of the above is visible before the SysTick handler takes over
+  relayRunning = 1;
 }
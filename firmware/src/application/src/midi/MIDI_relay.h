@@ -1,5 +1,99 @@
 #pragma once
 
+#include <stdint.h>
+
+typedef enum
+{
+  RELAY_CLASS_URGENT = 0,  // system real-time and channel messages
+  RELAY_CLASS_BULK,        // everything else, SysEx mainly
+  RELAY_CLASSES
+} RelayClass_t;
+
+// phases a packet's delay is split into for the histograms
+typedef enum
+{
+  RELAY_PHASE_WAIT = 0,  // from reception until its transmit is queued : RECEIVED, WAIT_FOR_XMIT_READY, bulk packets only
+  RELAY_PHASE_WIRE,      // from then until the outgoing host has taken it : WAIT_FOR_XMIT_DONE, all transmits, fast lane included
+  RELAY_PHASES
+} RelayPhase_t;
+
+// bucket 0 counts delays of 0 ticks, bucket n 2^(n-1) up to 2^n - 1 ticks, the last one anything longer
+#define RELAY_HIST_BUCKETS (16)
+
+typedef struct
+{
+  uint32_t bucket[RELAY_HIST_BUCKETS];
+} RelayHistogram_t;
+
+typedef struct
+{
+  uint32_t count;     // number of packets (bulk) or event packets (urgent)
+  uint32_t maxTicks;  // max. delay, in 125us ticks
+} RelayDelayStats_t;  // the counters of CMD_STATS
+
+typedef struct
+{
+  uint32_t timeouts;        // transfers the outgoing host did not take within the packet timeout
+  uint32_t oldest;          // packets dropped from the head of the queue, including those in transmit
+  uint32_t newest;          // packets dismissed behind the one in transmit, or on reception while stalled
+  uint32_t urgentEvents;    // event packets lost with an urgent transfer flushed from transmit
+  uint32_t keptEvents;      // non-SysEx event packets rescued from dropped packets ...
+  uint32_t lostEvents;      // ... and those lost, the priority lane had no room for all of a packet's
+  uint32_t closedSysex;     // F7 injected to terminate a SysEx that was cut off
+  uint32_t skippedEvents;   // event packets of the rest of a cut-off SysEx, discarded
+  uint32_t thinnedValues;   // controller, pitch bend and pressure events overwritten by a later one while congested
+  uint32_t thinnedSensing;  // active sensing events discarded while congested
+  uint32_t filteredEvents;  // event packets removed by the filter stage
+  uint32_t fastEvents;      // fast lane event packets lost : the outgoing host did not take them, or is offline
+} RelayDropStats_t;
+
+typedef struct
+{
+  uint32_t samples;         // transmits the estimate is based on, 0 --> initial timeouts
+  uint32_t acceptTicks;     // smoothed time the outgoing host takes to accept a transmit, in 125us ticks
+  uint32_t deviationTicks;  // mean deviation of it
+  uint32_t peakTicks;       // longest recent stall, decays over time
+  uint32_t timeoutTicks;    // resulting packet timeout ...
+  uint32_t shortTicks;      // ... and the one for the packet following a drop
+} RelayTimeoutStats_t;
+
+typedef struct
+{
+  uint32_t faults;     // USB errors that restarted the port's controller
+  uint32_t recovered;  // restarts after which the host has configured the port again ...
+  uint32_t lastTicks;  // ... and the time that took, in 125us ticks
+  uint32_t maxTicks;
+} RelayRecoveryStats_t;
+
+typedef struct
+{
+  uint32_t malformedEvents;  // event packets failing validation, removed with STRIP_MALFORMED only, see MIDI_validate.h
+  uint32_t oversize;         // transfers longer than the largest receive buffer, dismissed
+  uint32_t unexpected;       // transfers arriving with the packet queue full, the oldest packets made room
+} RelayReceiveStats_t;
+
+typedef struct
+{
+  uint32_t packets;          // bulk packets forwarded ...
+  uint32_t bytes;            // ... and the bytes of all transfers delivered, urgent and fast lane included
+  uint32_t dropped;          // PACKET_DROPPED events of the LED state monitor
+  uint32_t droppedIncoming;  // DROPPED_INCOMING events
+  uint32_t late;             // transmits delivered in SMON_LATE_TIME_US up to SMON_STALE_TIME_US from their start ...
+  uint32_t stale;            // ... and in SMON_STALE_TIME_US or longer
+} RelayTrafficStats_t;
+
+typedef struct
+{
+  uint32_t rate;            // bytes per second the port's host gets at most, 0 --> not shaped, see CMD_SHAPE
+  uint32_t burst;           // bytes it may get at once after a pause
+  uint32_t holds;           // times transmits started to be held back ...
+  uint32_t throttledTicks;  // ... and the time they were, in 125us ticks
+} RelayShaperStats_t;  // CMD_SHAPE settings and the counters of CMD_STATS
+
 void MIDI_Relay_Init(void);
-void MIDI_Relay_ProcessFast(void);
-void MIDI_Relay_Process(void);
+void MIDI_Relay_Tick(void);
+
+RelayDropStats_t const *    MIDI_Relay_GetDropStats(uint8_t const port);
+RelayRecoveryStats_t const *MIDI_Relay_GetRecoveryStats(uint8_t const port);
+RelayReceiveStats_t const * MIDI_Relay_GetReceiveStats(uint8_t const port);
+RelayTrafficStats_t const * MIDI_Relay_GetTrafficStats(uint8_t const port);
@@ -0,0 +1,72 @@
+#include "midi/MIDI_stamp.h"
+
+// raw position of an encoded SysEx byte, counted from the F0, 3 of them per event packet
+static inline uint32_t rawPos(uint32_t const i)
+{
+  return (i / 3) * 4 + 1 + i % 3;
+}
+
+// raw positions of a payload byte and of the top-bits byte of its 7-byte group, and its bit in there
+static inline void locate(uint32_t const k, uint32_t *const pData, uint32_t *const pTop, uint8_t *const pMask)
+{
+  *pTop  = rawPos(1 + (k / 7) * 8);
+  *pData = rawPos(1 + (k / 7) * 8 + 1 + k % 7);
+  *pMask = 0x40 >> (k % 7);
+}
+
+static inline uint64_t getField(uint8_t const *const msg, unsigned const field)
+{
+  uint64_t value = 0;
+
+  for (unsigned i = 8; i--;)
+  {
+    uint32_t data, top;
+    uint8_t  mask;
+    locate(field * 8 + i, &data, &top, &mask);
+    value = (value << 8) | msg[data] | ((msg[top] & mask) ? 0x80 : 0);
+  }
+  return value;
+}
+
+static inline void setField(uint8_t *const msg, unsigned const field, uint64_t value)
+{
+  for (unsigned i = 0; i < 8; i++, value >>= 8)
+  {
+    uint32_t data, top;
+    uint8_t  mask;
+    locate(field * 8 + i, &data, &top, &mask);
+    msg[data] = value & 0x7F;
+    msg[top]  = (value & 0x80) ? (msg[top] | mask) : (msg[top] & ~mask);
+  }
+}
+
+// a perf-test message asking for stamps starts here, and all of its header is in the buffer
+static inline int isStampable(uint8_t const *const msg, uint32_t const avail)
+{
+  if ((msg[0] & 0x0F) != 0x04 || msg[1] != 0xF0 || avail < STAMP_RAW_SPAN)
+    return 0;
+  for (uint32_t i = 4; i < STAMP_RAW_SPAN; i += 4)
+    if ((msg[i] & 0x0F) != 0x04)
+      return 0;  // SysEx ends within the header
+  return getField(msg, PERF_FIELD_MAGIC) == PERF_STAMP_MAGIC;
+}
+
+/******************************************************************************/
+/** @brief		Stamp the perf-test messages starting in a buffer
+    @param[in]	buff	USB-MIDI event packets
+    @param[in]	field	PERF_FIELD_INGRESS or PERF_FIELD_EGRESS
+    @param[in]	usecs	bridge's time
+    @return		number of messages stamped
+*******************************************************************************/
+unsigned STAMP_Apply(uint8_t *const buff, uint32_t const len, unsigned const field, uint64_t const usecs)
+{
+  unsigned n = 0;
+
+  for (uint32_t i = 0; i + 4 <= len; i += 4)
+    if (buff[i + 1] == 0xF0 && isStampable(&buff[i], len - i))
+    {
+      setField(&buff[i], field, usecs);
+      n++;
+    }
+  return n;
+}
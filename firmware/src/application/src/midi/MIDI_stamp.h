@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdint.h>
+#include "midi/nl_perftest_defs.h"
+
+// In-band timestamps for perf-test : the header of a message carrying PERF_STAMP_MAGIC gets the bridge's time
+// written into a field, right in the raw USB-MIDI data. Messages whose header is not completely within the
+// buffer are left alone, the receiver sees them unstamped.
+#define STAMP_RAW_SPAN (((PERF_HEADER_ENCODED + 2) / 3) * 4)  // raw bytes from the F0 on holding the header
+
+unsigned STAMP_Apply(uint8_t *const buff, uint32_t const len, unsigned const field, uint64_t const usecs);
@@ -5,8 +5,8 @@
 #define usToTicks(x) ((x + 75ul) / 125ul)     // usecs to 125 ticker counts
 #define msToTicks(x) (((x) *1000ul) / 125ul)  // msecs to 125 ticker counts
 
-#define LATE_TIME                     usToTicks(300)   // time until packet is considered LATE
-#define STALE_TIME                    msToTicks(2)     // time until packet is considered STALE
+#define LATE_TIME                     usToTicks(SMON_LATE_TIME_US)   // time until packet is considered LATE
+#define STALE_TIME                    usToTicks(SMON_STALE_TIME_US)  // time until packet is considered STALE
 #define NORMAL_HOT_INDICATOR_TIMEOUT  msToTicks(20)    // minimum hot display duration after end of packets
 #define DROPPED_HOT_INDICATOR_TIMEOUT msToTicks(300)   // hot display time of any dropped packets
 #define LATE_INDICATOR_TIMEOUT        msToTicks(2000)  // display time of "had late packets recently"
@@ -16,5 +16,9 @@ typedef enum
   LED_DISABLE
 } MonitorEvent_t;
 
+// packet transmit times, from start to delivery, from which on a packet counts as ...
+#define SMON_LATE_TIME_US  (300)   // ... LATE
+#define SMON_STALE_TIME_US (2000)  // ... STALE
+
 void SMON_monitorEvent(uint8_t const port, MonitorEvent_t const event);
 void SMON_Process(void);
@@ -0,0 +1,96 @@
+#include "midi/MIDI_validate.h"
+
+// what a byte is, one bit each
+#define B_DATA     (0x001)  // 00..7F
+#define B_CHANNEL  (0x002)  // 80..EF
+#define B_SOX      (0x004)  // F0
+#define B_COMMON1  (0x008)  // F6, system common without data bytes
+#define B_COMMON2  (0x010)  // F1, F3, ... with one data byte
+#define B_COMMON3  (0x020)  // F2, ... with two
+#define B_EOX      (0x040)  // F7
+#define B_REALTIME (0x080)  // F8..FF
+#define B_UNDEF    (0x100)  // F4, F5
+#define B_ANY      (0x1FF)  // byte not part of the message
+
+#define CLASS(b)                                                                             \
+  (uint16_t)(((b) < 0x80) ? B_DATA : ((b) < 0xF0) ? B_CHANNEL : ((b) == 0xF0) ? B_SOX       \
+             : ((b) == 0xF1 || (b) == 0xF3) ? B_COMMON2 : ((b) == 0xF2) ? B_COMMON3         \
+             : ((b) == 0xF6) ? B_COMMON1 : ((b) == 0xF7) ? B_EOX : ((b) >= 0xF8) ? B_REALTIME \
+                                                                   : B_UNDEF)
+#define ROW(r)                                                                                         \
+  CLASS(r + 0x0), CLASS(r + 0x1), CLASS(r + 0x2), CLASS(r + 0x3), CLASS(r + 0x4), CLASS(r + 0x5),      \
+      CLASS(r + 0x6), CLASS(r + 0x7), CLASS(r + 0x8), CLASS(r + 0x9), CLASS(r + 0xA), CLASS(r + 0xB), \
+      CLASS(r + 0xC), CLASS(r + 0xD), CLASS(r + 0xE), CLASS(r + 0xF)
+
+static uint16_t const classTable[256] = {
+  ROW(0x00), ROW(0x10), ROW(0x20), ROW(0x30), ROW(0x40), ROW(0x50), ROW(0x60), ROW(0x70),
+  ROW(0x80), ROW(0x90), ROW(0xA0), ROW(0xB0), ROW(0xC0), ROW(0xD0), ROW(0xE0), ROW(0xF0),
+};
+
+typedef struct
+{
+  uint16_t byte[3];  // classes each byte of the event may have
+  uint8_t  status;   // upper nibble the status byte must have, 0 --> any
+} CinRule_t;
+
+// per Code Index Number, with the length of the MIDI message it stands for
+static CinRule_t const cinTable[16] = {
+  { { 0, 0, 0 }, 0 },                                  // 0 : reserved, all-zero packets are padding though, see below
+  { { 0, 0, 0 }, 0 },                                  // 1 : reserved (cable events)
+  { { B_COMMON2, B_DATA, B_ANY }, 0 },                 // 2 : 2 bytes, system common
+  { { B_COMMON3, B_DATA, B_DATA }, 0 },                // 3 : 3 bytes, system common
+  { { B_SOX | B_DATA, B_DATA, B_DATA }, 0 },           // 4 : 3 bytes, SysEx starts or continues
+  { { B_COMMON1 | B_EOX, B_ANY, B_ANY }, 0 },          // 5 : 1 byte, system common or SysEx ends
+  { { B_SOX | B_DATA, B_EOX, B_ANY }, 0 },             // 6 : 2 bytes, SysEx ends
+  { { B_SOX | B_DATA, B_DATA, B_EOX }, 0 },            // 7 : 3 bytes, SysEx ends
+  { { B_CHANNEL, B_DATA, B_DATA }, 0x8 },              // 8 : 3 bytes, note off
+  { { B_CHANNEL, B_DATA, B_DATA }, 0x9 },              // 9 : 3 bytes, note on
+  { { B_CHANNEL, B_DATA, B_DATA }, 0xA },              // A : 3 bytes, poly pressure
+  { { B_CHANNEL, B_DATA, B_DATA }, 0xB },              // B : 3 bytes, control change
+  { { B_CHANNEL, B_DATA, B_ANY }, 0xC },               // C : 2 bytes, program change
+  { { B_CHANNEL, B_DATA, B_ANY }, 0xD },               // D : 2 bytes, channel pressure
+  { { B_CHANNEL, B_DATA, B_DATA }, 0xE },              // E : 3 bytes, pitch bend
+  { { B_ANY, B_ANY, B_ANY }, 0 },                      // F : 1 byte, any
+};
+
+/******************************************************************************/
+/** @brief		Check received data, strip malformed event packets when enabled
+    @param[in]	buff		USB-MIDI event packets
+    @param[in]	len			length in bytes
+    @param[in]	cables		number of cables of the interface
+    @param[out]	pMalformed	malformed event packets found are added, trailing
+							bytes count as one. All-zero packets are padding,
+							they are not counted but stripped as well
+    @return		length of the remaining data
+*******************************************************************************/
+uint32_t VALIDATE_Apply(uint8_t *const buff, uint32_t const len, unsigned const cables, uint32_t *const pMalformed)
+{
+  uint32_t kept = 0;
+  uint32_t bad  = 0;
+  uint32_t i;
+
+  for (i = 0; i + 4 <= len; i += 4)
+  {
+    CinRule_t const *const r  = &cinTable[buff[i] & 0x0F];
+    unsigned const         ok = ((buff[i] >> 4) < cables)
+        & ((classTable[buff[i + 1]] & r->byte[0]) != 0)
+        & ((classTable[buff[i + 2]] & r->byte[1]) != 0)
+        & ((classTable[buff[i + 3]] & r->byte[2]) != 0)
+        & ((r->status == 0) | ((buff[i + 1] >> 4) == r->status));
+    unsigned const pad = (buff[i] | buff[i + 1] | buff[i + 2] | buff[i + 3]) == 0;
+
+    bad += !ok & !pad;
+    if (VALIDATE_STRIP)
+    {  // always written, the output only advances for good events
+      buff[kept]     = buff[i];
+      buff[kept + 1] = buff[i + 1];
+      buff[kept + 2] = buff[i + 2];
+      buff[kept + 3] = buff[i + 3];
+      kept += 4 * ok;
+    }
+  }
+  if (i < len)
+    bad++;
+  *pMalformed += bad;
+  return VALIDATE_STRIP ? kept : len;
+}
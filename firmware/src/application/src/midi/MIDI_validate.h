@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+
+// Validation of received USB-MIDI event packets, before anything else looks at them. Each packet is checked
+// against a constant table per Code Index Number : which bytes make up the MIDI message and what each of them
+// may be (data byte, a status byte matching the CIN, F7 at the end of a SysEx...), plus the cable number
+// against the cables the interface offers. Padding bytes are not checked, many hosts leave garbage there.
+// Malformed event packets are counted, and only removed with STRIP_MALFORMED. All-zero packets, which some
+// hosts pad transfers with, are not counted.
+#ifdef STRIP_MALFORMED
+#define VALIDATE_STRIP (1)
+#else
+#define VALIDATE_STRIP (0)
+#endif
+
+uint32_t VALIDATE_Apply(uint8_t *const buff, uint32_t const len, unsigned const cables, uint32_t *const pMalformed);
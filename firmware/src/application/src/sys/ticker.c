@@ -1,3 +1,27 @@
 #include <stdint.h>
+#include "sys/ticker.h"
+#include "drv/nl_cgu.h"
+#include "cmsis/LPC43xx.h"
 
 volatile uint64_t ticker;
+
+/******************************************************************************/
+/** @brief		Time in usecs, finer than the ticker : the SysTick counter gives
+				the time elapsed within the current ticker period
+    @details	Must be called at the priority level of the SysTick interrupt,
+				so the ticker cannot move on in between. A period that has run
+				out while the interrupt is pending is accounted for.
+*******************************************************************************/
+uint64_t TICKER_usecs(void)
+{
+  uint32_t const reload  = SysTick->LOAD + 1;
+  uint32_t       pending = SCB->ICSR & SCB_ICSR_PENDSTSET_Msk;
+  uint32_t       count   = SysTick->VAL;
+
+  if (!pending && (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk))
+  {  // counter has just wrapped
+    pending = 1;
+    count   = SysTick->VAL;
+  }
+  return (ticker + (pending != 0)) * M4_PERIOD_US + ((uint64_t)(reload - 1 - count) * M4_PERIOD_US) / reload;
+}
@@ -5,3 +5,5 @@
 #define TIME_SLICE (1)  // time-slice for periodic tasks in M4_PERIOD_US (==125) usecs mutiples
 
 extern volatile uint64_t ticker;
+
+uint64_t TICKER_usecs(void);
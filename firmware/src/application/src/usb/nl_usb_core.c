@@ -50,8 +50,28 @@ static DTD_T ep_TD_0[EP_NUM_MAX] __attribute__((aligned(64)));
 static DQH_T ep_QH_1[EP_NUM_MAX] __attribute__((aligned(2048)));
 static DTD_T ep_TD_1[EP_NUM_MAX] __attribute__((aligned(64)));
 
+#if (USB_DTD_QUEUE_LEN & (USB_DTD_QUEUE_LEN - 1)) != 0
+#error "USB_DTD_QUEUE_LEN must be a power of 2"
+#endif
+
+/** dTD queue of a data endpoint (physical endpoints 2 and up) */
+typedef struct
+{
+  DTD_T             td[USB_DTD_QUEUE_LEN];   /**< descriptor pool, linked in order of enqueueing */
+  uint32_t          len[USB_DTD_QUEUE_LEN];  /**< requested length of each transfer */
+  volatile uint32_t head;                    /**< free running index of the next dTD to enqueue */
+  volatile uint32_t tail;                    /**< free running index of the oldest dTD not reaped yet */
+  uint32_t          lastLen;                 /**< bytes transferred by the most recently reaped dTD */
+  uint32_t          harvestLeft;             /**< bytes left in the running dTD at the previous harvest check */
+} __attribute__((aligned(32))) DTDQueue_t;  // dTDs must be on 32 byte boundaries
+
+static DTDQueue_t ep_DTDQ_0[EP_NUM_MAX - 2] __attribute__((section(".noinit.$RamAHB32")));
+static DTDQueue_t ep_DTDQ_1[EP_NUM_MAX - 2] __attribute__((section(".noinit.$RamAHB32")));
+
 static void USB_DummyEPHandler(uint8_t const port, uint32_t const event)
 {
+  (void) port;
+  (void) event;
 }
 
 typedef struct
@@ -59,6 +79,7 @@ typedef struct
   LPC_USB0_Type *       hardware;
   DQH_T *               ep_QH;
   DTD_T *               ep_TD;
+  DTDQueue_t *          ep_DTDQ;
   uint32_t              ep_read_len[3];
   EndpointCallback      P_EPCallback[USB_EP_NUM];
   InterfaceEventHandler Interface_Event;
@@ -94,12 +115,14 @@ static usb_core_t usb[2] = {
       .hardware     = ((LPC_USB0_Type *) LPC_USB0_BASE),
       .ep_QH        = &ep_QH_0[0],
       .ep_TD        = &ep_TD_0[0],
+      .ep_DTDQ      = &ep_DTDQ_0[0],
       .P_EPCallback = { USB_DummyEPHandler, USB_DummyEPHandler, USB_DummyEPHandler },
   },
   {
       .hardware     = ((LPC_USB0_Type *) LPC_USB1_BASE),
       .ep_QH        = &ep_QH_1[0],
       .ep_TD        = &ep_TD_1[0],
+      .ep_DTDQ      = &ep_DTDQ_1[0],
       .P_EPCallback = { USB_DummyEPHandler, USB_DummyEPHandler, USB_DummyEPHandler },
   },
 };
@@ -127,11 +150,25 @@ static inline uint32_t EPAdr(uint32_t const EPNum)
   return (val);
 }
 
+/******************************************************************************/
+/** @brief		Bit of a physical endpoint in the ENDPTxxx registers
+    @param[in]	Edpt	Endpoint number in the endpoint queue
+*******************************************************************************/
+static inline uint32_t EPBit(uint32_t const Edpt)
+{
+  return (Edpt & 1) ? (1 << (16 + (Edpt >> 1))) : (1 << (Edpt >> 1));
+}
+
+static inline DTDQueue_t *DTDQueue(uint8_t const port, uint32_t const Edpt)
+{
+  return &usb[port].ep_DTDQ[Edpt - 2];
+}
+
 /******************************************************************************/
 /** @brief		Set the USB device address
     @param[in]	adr		Device address
 *******************************************************************************/
-static void inline SetAddress(uint8_t const port, uint32_t const adr)
+static inline void SetAddress(uint8_t const port, uint32_t const adr)
 {
   usb[port].hardware->DEVICEADDR = USBDEV_ADDR(adr);
   usb[port].hardware->DEVICEADDR |= USBDEV_ADDR_AD;
@@ -175,12 +212,15 @@ static void Reset(uint8_t const port)
   /* Configure the Endpoint List Address */
   /* make sure it in on 64 byte boundary !!! */
   /* init list address */
-  usb[port].hardware->ENDPOINTLISTADDR = (uint32_t) & (usb[port].ep_QH[0]);
+  usb[port].hardware->ENDPOINTLISTADDR = (uintptr_t) & (usb[port].ep_QH[0]);
   /* Initialize device queue heads for non ISO endpoint only */
   for (i = 0; i < EP_NUM_MAX; i++)
   {
-    usb[port].ep_QH[i].next_dTD = (uint32_t) & (usb[port].ep_TD[i]);
+    usb[port].ep_QH[i].next_dTD = (uintptr_t) & (usb[port].ep_TD[i]);
   }
+  /* data endpoints use their dTD queues */
+  for (i = 2; i < EP_NUM_MAX; i++)
+    ClearDTD(port, i);
   /* Set DMA Burst Size */
   if (port == 0)
     usb[port].hardware->SBUSCFG = 0x07;  // as per user manual
@@ -391,6 +431,8 @@ uint8_t USB_Core_ConfigStatus(uint8_t const port)
 uint8_t USB_Core_ReadyToWrite(uint8_t const port, uint8_t const epnum)
 {
   uint32_t ep = EPAdr(epnum);
+  if (ep >= 2)  // data endpoint, a dTD must be free
+    return (DTDQueue(port, ep)->head - DTDQueue(port, ep)->tail) < USB_DTD_QUEUE_LEN;
   if ((usb[port].ep_TD[ep].next_dTD & 1) && ((usb[port].ep_TD[ep].total_bytes & 1 << 7) == 0))
     return 1;
   else
@@ -466,7 +508,7 @@ static inline void StatusInStage(uint8_t const port)
 /******************************************************************************/
 /** @brief		USB Request - Status out stage
 *******************************************************************************/
-static void inline StatusOutStage(uint8_t const port)
+static inline void StatusOutStage(uint8_t const port)
 {
   USB_ReadEP(port, 0x00);
 }
@@ -523,17 +565,17 @@ uint32_t USB_ReqGetStatus(uint8_t const port)
 
 static inline void WakeUpCfg(uint32_t const cfg)
 {
-  /* Not needed */
+  (void) cfg;  // not needed
 }
 
 static inline void Configure(uint32_t const cfg)
 {
-  /* Not needed */
+  (void) cfg;  // not needed
 }
 
 static inline void DirCtrlEP(uint32_t const dir)
 {
-  /* Not needed */
+  (void) dir;  // not needed
 }
 
 /******************************************************************************/
@@ -982,7 +1024,7 @@ uint32_t USB_ReqSetConfiguration(uint8_t const port)
   USB_COMMON_DESCRIPTOR *pD;
   uint32_t               alt = 0;
   uint32_t               n, m;
-  uint32_t               new_addr;
+  uintptr_t              new_addr;
   switch (usb[port].SetupPacket.bmRequestType.BM.Recipient)
   {
     case REQUEST_TO_DEVICE:
@@ -1036,7 +1078,7 @@ uint32_t USB_ReqSetConfiguration(uint8_t const port)
               }
               else
               {
-                new_addr = (uint32_t) pD + ((USB_CONFIGURATION_DESCRIPTOR *) pD)->wTotalLength;
+                new_addr = (uintptr_t) pD + ((USB_CONFIGURATION_DESCRIPTOR *) pD)->wTotalLength;
                 pD       = (USB_COMMON_DESCRIPTOR *) new_addr;
                 continue;
               }
@@ -1056,7 +1098,7 @@ uint32_t USB_ReqSetConfiguration(uint8_t const port)
               }
               break;
           }
-          new_addr = (uint32_t) pD + pD->bLength;
+          new_addr = (uintptr_t) pD + pD->bLength;
           pD       = (USB_COMMON_DESCRIPTOR *) new_addr;
         }
       }
@@ -1125,7 +1167,8 @@ uint32_t USB_ReqSetInterface(uint8_t const port)
   USB_COMMON_DESCRIPTOR *pD;
   uint32_t               ifn = 0, alt = 0, old = 0, msk = 0;
   uint32_t               n, m;
-  uint32_t               set, new_addr;
+  uint32_t               set;
+  uintptr_t              new_addr;
 
   switch (usb[port].SetupPacket.bmRequestType.BM.Recipient)
   {
@@ -1148,7 +1191,7 @@ uint32_t USB_ReqSetInterface(uint8_t const port)
           case USB_CONFIGURATION_DESCRIPTOR_TYPE:
             if (((USB_CONFIGURATION_DESCRIPTOR *) pD)->bConfigurationValue != usb[port].Configuration)
             {
-              new_addr = (uint32_t) pD + ((USB_CONFIGURATION_DESCRIPTOR *) pD)->wTotalLength;
+              new_addr = (uintptr_t) pD + ((USB_CONFIGURATION_DESCRIPTOR *) pD)->wTotalLength;
               pD       = (USB_COMMON_DESCRIPTOR *) new_addr;
               continue;
             }
@@ -1187,7 +1230,7 @@ uint32_t USB_ReqSetInterface(uint8_t const port)
             }
             break;
         }
-        new_addr = (uint32_t) pD + pD->bLength;
+        new_addr = (uintptr_t) pD + pD->bLength;
         pD       = (USB_COMMON_DESCRIPTOR *) new_addr;
       }
       break;
@@ -1401,6 +1444,30 @@ static inline void SetError(uint8_t const port)
 #define STATUS_BITS (0xC0)
 #define CLEAR_MASK  (0x7FFF00C0)
 
+/******************************************************************************/
+/** @brief		Retire completed dTDs of a data endpoint queue in order
+    @param[in]	Edpt	Endpoint number in the endpoint queue
+    @param[in]	event	Event passed to the endpoint callback for each dTD
+*******************************************************************************/
+static inline void ReapDTD(uint8_t const port, uint32_t const Edpt, uint32_t const event)
+{
+  DTDQueue_t *q = DTDQueue(port, Edpt);
+  uint32_t    token, left;
+
+  while (q->tail != q->head)
+  {
+    token = q->td[q->tail % USB_DTD_QUEUE_LEN].total_bytes;
+    if (token & 0x80)
+      return;  // still active, so are all dTDs behind it
+    left = (token >> 16) & 0x7FFF;
+    if ((token & 0x40) || ((Edpt & 1) && left != 0))
+      SetError(port);  // halted, or IN transfer not sent completely
+    q->lastLen = q->len[q->tail % USB_DTD_QUEUE_LEN] - left;
+    q->tail++;
+    usb[port].P_EPCallback[Edpt >> 1](port, event);
+  }
+}
+
 static inline void Handler(uint8_t const port)
 {
   uint32_t disr, val, n;
@@ -1453,31 +1520,19 @@ static inline void Handler(uint8_t const port)
         usb[port].hardware->ENDPTCOMPLETE = (1 << 16);
         usb[port].P_EPCallback[0](port, USB_EVT_IN);
       }
-      /* EP 1 - OUT */
-      if (val & 2)
-      {
-        usb[port].hardware->ENDPTCOMPLETE = 2;
-        if (usb[port].ep_TD[2].total_bytes & STATUS_BITS)
-          SetError(port);
-        usb[port].P_EPCallback[1](port, USB_EVT_OUT);
-      }
-      /* EP 1 - IN */
-      if (val & (1 << 17))
+      /* data endpoints, reap all finished dTDs of their queues */
+      for (n = 1; n < USB_EP_NUM; n++)
       {
-        usb[port].ep_TD[3].total_bytes &= CLEAR_MASK;  // isolate byte count
-        usb[port].hardware->ENDPTCOMPLETE = (1 << 17);
-        if (usb[port].ep_TD[3].total_bytes != 0)
-          SetError(port);
-        usb[port].P_EPCallback[1](port, USB_EVT_IN);
-      }
-      /* EP 2 - IN */
-      if (val & (1 << 18))
-      {
-        usb[port].ep_TD[5].total_bytes &= CLEAR_MASK;  // isolate byte count
-        usb[port].hardware->ENDPTCOMPLETE = (1 << 18);
-        if (usb[port].ep_TD[5].total_bytes != 0)
-          SetError(port);
-        usb[port].P_EPCallback[2](port, USB_EVT_IN);
+        if (val & (1 << n))
+        {
+          usb[port].hardware->ENDPTCOMPLETE = (1 << n);
+          ReapDTD(port, 2 * n, USB_EVT_OUT);
+        }
+        if (val & (1 << (n + 16)))
+        {
+          usb[port].hardware->ENDPTCOMPLETE = (1 << (n + 16));
+          ReapDTD(port, 2 * n + 1, USB_EVT_IN);
+        }
       }
     }
 
@@ -1542,9 +1597,6 @@ static inline void Handler(uint8_t const port)
       usb[port].activity = 1;
       SetError(port);
     }
-
-    if (usb[port].activity)
-      ;  // indicate general activity
   } while (1);
 }
 
@@ -1576,20 +1628,81 @@ void USB_ProgDTD(uint8_t const port, uint32_t Edpt, uint32_t ptrBuff, uint32_t T
   pDTD->buffer3 = (ptrBuff + 0x3000) & 0xfffff000;
   pDTD->buffer4 = (ptrBuff + 0x4000) & 0xfffff000;
 
-  usb[port].ep_QH[Edpt].next_dTD = (uint32_t)(&usb[port].ep_TD[Edpt]);
+  usb[port].ep_QH[Edpt].next_dTD = (uintptr_t)(&usb[port].ep_TD[Edpt]);
   usb[port].ep_QH[Edpt].total_bytes &= (~0xC0);
 }
 
+/******************************************************************************/
+/** @brief		Drop all dTDs of a data endpoint queue
+    @param[in]	Edpt	Endpoint number in the endpoint queue
+*******************************************************************************/
 static void ClearDTD(uint8_t const port, uint32_t Edpt)
 {
-  DTD_T *pDTD;
-
-  pDTD = (DTD_T *) &usb[port].ep_TD[Edpt];
+  DTDQueue_t *q = DTDQueue(port, Edpt);
 
   /* Zero out the device transfer descriptors */
-  memset((void *) pDTD, 0, sizeof(DTD_T));
+  memset((void *) q, 0, sizeof(DTDQueue_t));
   /* The next DTD pointer is INVALID */
-  pDTD->next_dTD = 0x01;
+  usb[port].ep_QH[Edpt].next_dTD = 0x01;
+}
+
+/******************************************************************************/
+/** @brief		Append a transfer to the dTD queue of a data endpoint
+    @param[in]	Edpt	Endpoint number in the endpoint queue
+    @param[in]	ptrBuff	Pointer to data buffer
+    @param[in]	TsfSize	Size of the transfer buffer
+    @return		1 - Success ; 0 - no free dTD
+*******************************************************************************/
+static uint32_t QueueDTD(uint8_t const port, uint32_t Edpt, uint32_t ptrBuff, uint32_t TsfSize)
+{
+  DTDQueue_t *q   = DTDQueue(port, Edpt);
+  uint32_t    bit = EPBit(Edpt);
+  DTD_T *     pDTD;
+  DTD_T *     pLast;
+  uint32_t    active;
+
+  if ((q->head - q->tail) >= USB_DTD_QUEUE_LEN)
+    return 0;
+
+  pDTD = &q->td[q->head % USB_DTD_QUEUE_LEN];
+  /* The next DTD pointer is INVALID */
+  pDTD->next_dTD    = 0x01;
+  pDTD->total_bytes = ((TsfSize & 0x7fff) << 16) | TD_IOC | 0x80;
+  pDTD->buffer0     = ptrBuff;
+  pDTD->buffer1     = (ptrBuff + 0x1000) & 0xfffff000;
+  pDTD->buffer2     = (ptrBuff + 0x2000) & 0xfffff000;
+  pDTD->buffer3     = (ptrBuff + 0x3000) & 0xfffff000;
+  pDTD->buffer4     = (ptrBuff + 0x4000) & 0xfffff000;
+  q->len[q->head % USB_DTD_QUEUE_LEN] = TsfSize;
+
+  if (q->head == q->tail)
+  {  // queue is empty, endpoint is idle
+    q->head++;
+    usb[port].ep_QH[Edpt].next_dTD = (uintptr_t) pDTD;
+    usb[port].ep_QH[Edpt].total_bytes &= (~0xC0);
+    usb[port].hardware->ENDPTPRIME |= bit;
+    return 1;
+  }
+
+  // link behind the last dTD, the controller picks it up when still running on that list
+  pLast           = &q->td[(q->head - 1) % USB_DTD_QUEUE_LEN];
+  pLast->next_dTD = (uintptr_t) pDTD;
+  q->head++;
+  if (usb[port].hardware->ENDPTPRIME & bit)
+    return 1;  // pending prime will fetch the list
+  do  // find out whether the endpoint was still active while linking, using the add dTD tripwire
+  {
+    usb[port].hardware->USBCMD_D |= USBCMD_ATDTW;
+    active = usb[port].hardware->ENDPTSTAT & bit;
+  } while (!(usb[port].hardware->USBCMD_D & USBCMD_ATDTW));
+  usb[port].hardware->USBCMD_D &= ~USBCMD_ATDTW;
+  if (!active)
+  {  // endpoint had already run out of dTDs, start over with the new one
+    usb[port].ep_QH[Edpt].next_dTD = (uintptr_t) pDTD;
+    usb[port].ep_QH[Edpt].total_bytes &= (~0xC0);
+    usb[port].hardware->ENDPTPRIME |= bit;
+  }
+  return 1;
 }
 
 /******************************************************************************/
@@ -1605,7 +1718,10 @@ uint32_t USB_WriteEP(uint8_t const port, uint32_t EPNum, uint8_t *pData, uint32_
 {
   uint32_t n = USB_EP_BITPOS(EPNum);
 
-  USB_ProgDTD(port, EPAdr(EPNum), (uint32_t) pData, cnt);
+  if (EPAdr(EPNum) >= 2)
+    return QueueDTD(port, EPAdr(EPNum), (uintptr_t) pData, cnt) ? cnt : 0;
+
+  USB_ProgDTD(port, EPAdr(EPNum), (uintptr_t) pData, cnt);
   /* prime the endpoint for transmit */
   usb[port].hardware->ENDPTPRIME |= (1 << n);
 
@@ -1624,7 +1740,9 @@ uint32_t USB_ReadEP(uint8_t const port, uint32_t EPNum)
   uint32_t cnt, n;
   DTD_T *  pDTD;
 
-  n    = EPAdr(EPNum);
+  n = EPAdr(EPNum);
+  if (n >= 2)
+    return DTDQueue(port, n)->lastLen;
   pDTD = (DTD_T *) &(usb[port].ep_TD[n]);
 
   /* return the total bytes read */
@@ -1640,14 +1758,17 @@ uint32_t USB_ReadEP(uint8_t const port, uint32_t EPNum)
     					3:0	Endpoint number
     @param[in]	pData	Pointer to data buffer
     @param[in]	len		Length of the data buffer
-    @return		Length of the data buffer
+    @return		Length of the data buffer ; 0 - no free dTD on a data endpoint
 *******************************************************************************/
 uint32_t USB_ReadReqEP(uint8_t const port, uint32_t EPNum, uint8_t *pData, uint32_t len)
 {
   uint32_t num = EPAdr(EPNum);
   uint32_t n   = USB_EP_BITPOS(EPNum);
 
-  USB_ProgDTD(port, num, (uint32_t) pData, len);
+  if (num >= 2)
+    return QueueDTD(port, num, (uintptr_t) pData, len) ? len : 0;
+
+  USB_ProgDTD(port, num, (uintptr_t) pData, len);
   usb[port].ep_read_len[EPNum & 0x0F] = len;
   /* prime the endpoint for read */
   usb[port].hardware->ENDPTPRIME |= (1 << n);
@@ -1664,7 +1785,110 @@ uint32_t USB_ReadReqEP(uint8_t const port, uint32_t EPNum, uint8_t *pData, uint3
 *******************************************************************************/
 int32_t USB_Core_BytesToSend(uint8_t const port, uint32_t ep)
 {
-  return usb[port].ep_TD[EPAdr(ep)].total_bytes >> 16;
+  DTDQueue_t *q;
+  uint32_t    i;
+  int32_t     bytes = 0;
+
+  if (EPAdr(ep) < 2)
+    return usb[port].ep_TD[EPAdr(ep)].total_bytes >> 16;
+  q = DTDQueue(port, EPAdr(ep));
+  for (i = q->tail; i != q->head; i++)
+    if (q->td[i % USB_DTD_QUEUE_LEN].total_bytes & 0x80)
+      bytes += (q->td[i % USB_DTD_QUEUE_LEN].total_bytes >> 16) & 0x7FFF;
+  return bytes;
+}
+
+/******************************************************************************/
+/** @brief		End a partially filled receive transfer
+    @details	Hosts do not always terminate a transfer with a short packet. When the
+				running dTD of an OUT endpoint has received data but made no progress
+				since the previous call, the endpoint is stopped, the dTD is retired
+				with what it got so far and the remaining queue is restarted.
+				Must not be interrupted by the USB interrupt of the port, so call it
+				at its priority level or with it disabled.
+    @param[in]	EPNum	Endpoint number and direction
+    					7	Direction (0 - out; 1-in)
+    					3:0	Endpoint number
+    @return		1 - a transfer was ended ; 0 - nothing to do
+*******************************************************************************/
+uint32_t USB_HarvestEP(uint8_t const port, uint32_t EPNum)
+{
+  uint32_t    num = EPAdr(EPNum);
+  uint32_t    bit = EPBit(num);
+  DTDQueue_t *q   = DTDQueue(port, num);
+  DTD_T *     pDTD;
+  uint32_t    i, left;
+
+  if (q->tail == q->head)
+    return 0;
+  pDTD = &q->td[q->tail % USB_DTD_QUEUE_LEN];
+  if (!(pDTD->total_bytes & 0x80))
+    return 0;  // finished already, completion interrupt will reap it
+  if ((usb[port].ep_QH[num].curr_dTD & ~0x1F) != (uintptr_t) pDTD)
+    return 0;  // not started yet
+  left = (usb[port].ep_QH[num].total_bytes >> 16) & 0x7FFF;
+  if (left == q->len[q->tail % USB_DTD_QUEUE_LEN] || left != q->harvestLeft)
+  {  // nothing received yet, or still receiving
+    q->harvestLeft = left;
+    return 0;
+  }
+  q->harvestLeft = 0;
+
+  /* stop the endpoint */
+  do
+  {
+    usb[port].hardware->ENDPTFLUSH = bit;
+    while (usb[port].hardware->ENDPTFLUSH & bit)
+      asm volatile("nop");
+  } while ((usb[port].hardware->ENDPTSTAT & bit) != 0);
+
+  /* retire the dTD the controller was working on, it may have moved on right before the flush */
+  for (i = q->tail; i != q->head; i++)
+  {
+    pDTD = &q->td[i % USB_DTD_QUEUE_LEN];
+    if (!(pDTD->total_bytes & 0x80))
+      continue;
+    if ((usb[port].ep_QH[num].curr_dTD & ~0x1F) == (uintptr_t) pDTD)
+    {
+      left = (usb[port].ep_QH[num].total_bytes >> 16) & 0x7FFF;
+      if (left != q->len[i % USB_DTD_QUEUE_LEN])
+      {
+        pDTD->total_bytes = left << 16;
+        continue;
+      }
+    }
+    break;
+  }
+
+  /* restart with the first dTD still active */
+  if (i != q->head)
+  {
+    usb[port].ep_QH[num].next_dTD = (uintptr_t) &q->td[i % USB_DTD_QUEUE_LEN];
+    usb[port].ep_QH[num].total_bytes &= (~0xC0);
+    usb[port].hardware->ENDPTPRIME |= bit;
+  }
+
+  ReapDTD(port, num, USB_EVT_OUT);
+  return 1;
+}
+
+/******************************************************************************/
+/** @brief		Gets the number of transfers queued on a data endpoint and not yet finished
+    @param[in]	ep		Endpoint number and direction
+    					7	Direction (0 - out; 1-in)
+    					3:0	Endpoint number
+    @return		        number of active dTDs
+*******************************************************************************/
+uint32_t USB_Core_PendingTransfers(uint8_t const port, uint32_t ep)
+{
+  DTDQueue_t *q = DTDQueue(port, EPAdr(ep));
+  uint32_t    i;
+  uint32_t    cnt = 0;
+
+  for (i = q->tail; i != q->head; i++)
+    if (q->td[i % USB_DTD_QUEUE_LEN].total_bytes & 0x80)
+      cnt++;
+  return cnt;
 }
 
 void USB_Core_Device_Descriptor_Set(uint8_t const port, const uint8_t *ddesc)
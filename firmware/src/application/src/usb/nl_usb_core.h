@@ -19,6 +19,10 @@
 /** Maximum length of a Control endpoint packet */
 #define USB_MAX_PACKET0 64
 
+/** Number of dTDs that can be queued on a data endpoint (power of 2) */
+#ifndef USB_DTD_QUEUE_LEN
+#define USB_DTD_QUEUE_LEN 4
+#endif
 /** USB driver in polling mode? */
 #define USB_POLLING 0
 
@@ -243,7 +247,9 @@ void     USB_ProgDTD(uint8_t const port, uint32_t Edpt, uint32_t ptrBuff, uint32
 uint32_t USB_WriteEP(uint8_t const port, uint32_t EPNum, uint8_t *pData, uint32_t cnt);
 uint32_t USB_ReadEP(uint8_t const port, uint32_t EPNum);
 uint32_t USB_ReadReqEP(uint8_t const port, uint32_t EPNum, uint8_t *pData, uint32_t len);
+uint32_t USB_HarvestEP(uint8_t const port, uint32_t EPNum);
 int32_t  USB_Core_BytesToSend(uint8_t const port, uint32_t ep);
+uint32_t USB_Core_PendingTransfers(uint8_t const port, uint32_t ep);
 void     USB_Core_Device_Descriptor_Set(uint8_t const port, const uint8_t *ddesc);
 void     USB_Core_Device_FS_Descriptor_Set(uint8_t const port, const uint8_t *fsdesc);
 void     USB_Core_Device_HS_Descriptor_Set(uint8_t const port, const uint8_t *hsdesc);
@@ -47,6 +47,53 @@ const uint8_t USB1_MIDI_DeviceDescriptor[] = {
   0x01,                       /* bNumConfigurations */
 };
 
+/** Jack descriptors of cable n (0-based) : embedded and external IN jack, then embedded and external OUT jack,
+    IDs 4n+1 ... 4n+4. Each OUT jack is sourced by the IN jack of the other kind */
+#define USB_MIDI_CABLE_JACKS(n)                                                                                 \
+  USB_MIDI_IN_JACK_SIZE, USB_CS_INTERFACE_DESC_TYPE, USB_MIDI_IN_JACK_SUBTYPE, USB_MIDI_JACK_EMBEDDED,          \
+      4 * (n) + 1, 0x00,                                                                                        \
+      USB_MIDI_IN_JACK_SIZE, USB_CS_INTERFACE_DESC_TYPE, USB_MIDI_IN_JACK_SUBTYPE, USB_MIDI_JACK_EXTERNAL,      \
+      4 * (n) + 2, 0x00,                                                                                        \
+      USB_MIDI_OUT_JACK_SIZE, USB_CS_INTERFACE_DESC_TYPE, USB_MIDI_OUT_JACK_SUBTYPE, USB_MIDI_JACK_EMBEDDED,    \
+      4 * (n) + 3, 0x01, 4 * (n) + 2, 0x01, 0x00,                                                               \
+      USB_MIDI_OUT_JACK_SIZE, USB_CS_INTERFACE_DESC_TYPE, USB_MIDI_OUT_JACK_SUBTYPE, USB_MIDI_JACK_EXTERNAL,    \
+      4 * (n) + 4, 0x01, 4 * (n) + 1, 0x01, 0x00
+
+/** all cables' jacks, and the embedded jacks associated with the bulk OUT and IN endpoint */
+#if USB_MIDI_CABLES == 1
+#define USB_MIDI_JACKS              USB_MIDI_CABLE_JACKS(0)
+#define USB_MIDI_EMBEDDED_IN_JACKS  0x01
+#define USB_MIDI_EMBEDDED_OUT_JACKS 0x03
+#elif USB_MIDI_CABLES == 2
+#define USB_MIDI_JACKS              USB_MIDI_CABLE_JACKS(0), USB_MIDI_CABLE_JACKS(1)
+#define USB_MIDI_EMBEDDED_IN_JACKS  0x01, 0x05
+#define USB_MIDI_EMBEDDED_OUT_JACKS 0x03, 0x07
+#elif USB_MIDI_CABLES == 3
+#define USB_MIDI_JACKS              USB_MIDI_CABLE_JACKS(0), USB_MIDI_CABLE_JACKS(1), USB_MIDI_CABLE_JACKS(2)
+#define USB_MIDI_EMBEDDED_IN_JACKS  0x01, 0x05, 0x09
+#define USB_MIDI_EMBEDDED_OUT_JACKS 0x03, 0x07, 0x0B
+#else
+#define USB_MIDI_JACKS              USB_MIDI_CABLE_JACKS(0), USB_MIDI_CABLE_JACKS(1), USB_MIDI_CABLE_JACKS(2), USB_MIDI_CABLE_JACKS(3)
+#define USB_MIDI_EMBEDDED_IN_JACKS  0x01, 0x05, 0x09, 0x0D
+#define USB_MIDI_EMBEDDED_OUT_JACKS 0x03, 0x07, 0x0B, 0x0F
+#endif
+
+#ifdef FAST_LANE_ENDPOINTS
+/** Interface 2 : MIDI Streaming interface of the fast lane, one cable with jacks following those of interface 1 */
+#define USB_MIDI_FAST_INTERFACE(maxPacket)                                                                      \
+  USB_INTERFACE_DESC_SIZE, USB_INTERFACE_DESCRIPTOR_TYPE, 0x02, 0x00, 0x02, USB_DEVICE_CLASS_AUDIO,             \
+      USB_SUBCLASS_MIDI_STREAMING, 0x00, 0x00,                                                                  \
+      USB_CS_MIDI_STREAMING_SIZE, USB_CS_INTERFACE_DESC_TYPE, USB_MIDI_HEADER_SUBTYPE, WBVAL(BCDADC_1_0),       \
+      WBVAL(USB_CS_FAST_STREAMING_TOTAL),                                                                       \
+      USB_MIDI_CABLE_JACKS(USB_MIDI_CABLES),                                                                    \
+      USB_AUDIO_ENDPOINT_DESC_SIZE, USB_ENDPOINT_DESCRIPTOR_TYPE, USB_ENDPOINT_OUT(MIDI_EP_FAST_OUT),           \
+      USB_ENDPOINT_TYPE_BULK, WBVAL(maxPacket), 0x00, 0x00, 0x00,                                               \
+      0x05, USB_CS_ENDPOINT_DESC_TYPE, USB_MIDI_EP_GENERAL_SUBTYPE, 0x01, 4 * USB_MIDI_CABLES + 1,              \
+      USB_AUDIO_ENDPOINT_DESC_SIZE, USB_ENDPOINT_DESCRIPTOR_TYPE, USB_ENDPOINT_IN(MIDI_EP_FAST_IN),             \
+      USB_ENDPOINT_TYPE_BULK, WBVAL(maxPacket), 0x00, 0x00, 0x00,                                               \
+      0x05, USB_CS_ENDPOINT_DESC_TYPE, USB_MIDI_EP_GENERAL_SUBTYPE, 0x01, 4 * USB_MIDI_CABLES + 3
+#endif
+
 /** USB FSConfiguration Descriptor */
 /*   All Descriptors (Configuration, Interface, Endpoint, Class */
 const uint8_t USB_MIDI_FSConfigDescriptor[] = {
@@ -54,7 +101,7 @@ const uint8_t USB_MIDI_FSConfigDescriptor[] = {
   USB_CONFIGURATION_DESC_SIZE,       /* bLength */
   USB_CONFIGURATION_DESCRIPTOR_TYPE, /* bDescriptorType */
   WBVAL(CONFIG_BLOCK_SIZE),
-  0x02,                     /* bNumInterfaces */
+  1 + USB_MIDI_INTERFACES,  /* bNumInterfaces */
   0x01,                     /* bConfigurationValue: 0x01 is used to select this configuration */
   0x00,                     /* iConfiguration: no string to describe this configuration */
   USB_CONFIG_BUS_POWERED,   /* bmAttributes */
@@ -75,8 +122,11 @@ const uint8_t USB_MIDI_FSConfigDescriptor[] = {
   USB_MIDI_HEADER_SUBTYPE,
   WBVAL(BCDADC_1_0),
   WBVAL(USB_CS_AUDIO_CONTROL_TOTAL),
-  0x01,
-  0x01,
+  USB_MIDI_INTERFACES, /* bInCollection */
+  0x01,                /* baInterfaceNr */
+#ifdef FAST_LANE_ENDPOINTS
+  0x02,
+#endif
   /** Interface 1: standard midistreaming interface descriptor */
   USB_INTERFACE_DESC_SIZE,
   USB_INTERFACE_DESCRIPTOR_TYPE,
@@ -93,40 +143,7 @@ const uint8_t USB_MIDI_FSConfigDescriptor[] = {
   USB_MIDI_HEADER_SUBTYPE,
   WBVAL(BCDADC_1_0),
   WBVAL(USB_CS_MIDI_STREAMING_TOTAL),
-  /** MIDI IN jack - embedded */
-  USB_MIDI_IN_JACK_SIZE,
-  USB_CS_INTERFACE_DESC_TYPE,
-  USB_MIDI_IN_JACK_SUBTYPE,
-  USB_MIDI_JACK_EMBEDDED,
-  0x01,
-  0x00,
-  /** MIDI IN jack - external */
-  USB_MIDI_IN_JACK_SIZE,
-  USB_CS_INTERFACE_DESC_TYPE,
-  USB_MIDI_IN_JACK_SUBTYPE,
-  USB_MIDI_JACK_EXTERNAL,
-  0x02,
-  0x00,
-  /** MIDI OUT jack - embedded */
-  USB_MIDI_OUT_JACK_SIZE,
-  USB_CS_INTERFACE_DESC_TYPE,
-  USB_MIDI_OUT_JACK_SUBTYPE,
-  USB_MIDI_JACK_EMBEDDED,
-  0x03,
-  0x01,
-  0x02,
-  0x01,
-  0x00,
-  /** MIDI OUT jack - external */
-  USB_MIDI_OUT_JACK_SIZE,
-  USB_CS_INTERFACE_DESC_TYPE,
-  USB_MIDI_OUT_JACK_SUBTYPE,
-  USB_MIDI_JACK_EXTERNAL,
-  0x04,
-  0x01,
-  0x01,
-  0x01,
-  0x00,
+  USB_MIDI_JACKS,
   /** Bulk OUT - standard endpoint descriptor */
   USB_AUDIO_ENDPOINT_DESC_SIZE,
   USB_ENDPOINT_DESCRIPTOR_TYPE,
@@ -140,8 +157,8 @@ const uint8_t USB_MIDI_FSConfigDescriptor[] = {
   USB_MIDI_ENDPOINT_DESC_SIZE,
   USB_CS_ENDPOINT_DESC_TYPE,
   USB_MIDI_EP_GENERAL_SUBTYPE,
-  0x01,
-  0x01,
+  USB_MIDI_CABLES,
+  USB_MIDI_EMBEDDED_IN_JACKS,
   /** BULK IN - standard endpoint descriptor */
   USB_AUDIO_ENDPOINT_DESC_SIZE,
   USB_ENDPOINT_DESCRIPTOR_TYPE,
@@ -155,8 +172,11 @@ const uint8_t USB_MIDI_FSConfigDescriptor[] = {
   USB_MIDI_ENDPOINT_DESC_SIZE,
   USB_CS_ENDPOINT_DESC_TYPE,
   USB_MIDI_EP_GENERAL_SUBTYPE,
-  0x01,
-  0x03,
+  USB_MIDI_CABLES,
+  USB_MIDI_EMBEDDED_OUT_JACKS,
+#ifdef FAST_LANE_ENDPOINTS
+  USB_MIDI_FAST_INTERFACE(USB_FS_BULK_SIZE),
+#endif
   /* Terminator */
   0
 };
@@ -168,7 +188,7 @@ const uint8_t USB_MIDI_HSConfigDescriptor[] = {
   USB_CONFIGURATION_DESC_SIZE,       /* bLength */
   USB_CONFIGURATION_DESCRIPTOR_TYPE, /* bDescriptorType */
   WBVAL(CONFIG_BLOCK_SIZE),
-  0x02,                     /* bNumInterfaces */
+  1 + USB_MIDI_INTERFACES,  /* bNumInterfaces */
   0x01,                     /* bConfigurationValue: 0x01 is used to select this configuration */
   0x00,                     /* iConfiguration: no string to describe this configuration */
   USB_CONFIG_BUS_POWERED,   /* bmAttributes */
@@ -189,8 +209,11 @@ const uint8_t USB_MIDI_HSConfigDescriptor[] = {
   USB_MIDI_HEADER_SUBTYPE,
   WBVAL(BCDADC_1_0),
   WBVAL(USB_CS_AUDIO_CONTROL_TOTAL),
-  0x01,
-  0x01,
+  USB_MIDI_INTERFACES, /* bInCollection */
+  0x01,                /* baInterfaceNr */
+#ifdef FAST_LANE_ENDPOINTS
+  0x02,
+#endif
   /** Interface 1: standard midistreaming interface descriptor */
   USB_INTERFACE_DESC_SIZE,
   USB_INTERFACE_DESCRIPTOR_TYPE,
@@ -207,40 +230,7 @@ const uint8_t USB_MIDI_HSConfigDescriptor[] = {
   USB_MIDI_HEADER_SUBTYPE,
   WBVAL(BCDADC_1_0),
   WBVAL(USB_CS_MIDI_STREAMING_TOTAL),
-  /** MIDI IN jack - embedded */
-  USB_MIDI_IN_JACK_SIZE,
-  USB_CS_INTERFACE_DESC_TYPE,
-  USB_MIDI_IN_JACK_SUBTYPE,
-  USB_MIDI_JACK_EMBEDDED,
-  0x01,
-  0x00,
-  /** MIDI IN jack - external */
-  USB_MIDI_IN_JACK_SIZE,
-  USB_CS_INTERFACE_DESC_TYPE,
-  USB_MIDI_IN_JACK_SUBTYPE,
-  USB_MIDI_JACK_EXTERNAL,
-  0x02,
-  0x00,
-  /** MIDI OUT jack - embedded */
-  USB_MIDI_OUT_JACK_SIZE,
-  USB_CS_INTERFACE_DESC_TYPE,
-  USB_MIDI_OUT_JACK_SUBTYPE,
-  USB_MIDI_JACK_EMBEDDED,
-  0x03,
-  0x01,
-  0x02,
-  0x01,
-  0x00,
-  /** MIDI OUT jack - external */
-  USB_MIDI_OUT_JACK_SIZE,
-  USB_CS_INTERFACE_DESC_TYPE,
-  USB_MIDI_OUT_JACK_SUBTYPE,
-  USB_MIDI_JACK_EXTERNAL,
-  0x04,
-  0x01,
-  0x01,
-  0x01,
-  0x00,
+  USB_MIDI_JACKS,
   /** Bulk OUT - standard endpoint descriptor */
   USB_AUDIO_ENDPOINT_DESC_SIZE,
   USB_ENDPOINT_DESCRIPTOR_TYPE,
@@ -254,8 +244,8 @@ const uint8_t USB_MIDI_HSConfigDescriptor[] = {
   USB_MIDI_ENDPOINT_DESC_SIZE,
   USB_CS_ENDPOINT_DESC_TYPE,
   USB_MIDI_EP_GENERAL_SUBTYPE,
-  0x01,
-  0x01,
+  USB_MIDI_CABLES,
+  USB_MIDI_EMBEDDED_IN_JACKS,
   /** BULK IN - standard endpoint descriptor */
   USB_AUDIO_ENDPOINT_DESC_SIZE,
   USB_ENDPOINT_DESCRIPTOR_TYPE,
@@ -269,8 +259,11 @@ const uint8_t USB_MIDI_HSConfigDescriptor[] = {
   USB_MIDI_ENDPOINT_DESC_SIZE,
   USB_CS_ENDPOINT_DESC_TYPE,
   USB_MIDI_EP_GENERAL_SUBTYPE,
-  0x01,
-  0x03,
+  USB_MIDI_CABLES,
+  USB_MIDI_EMBEDDED_OUT_JACKS,
+#ifdef FAST_LANE_ENDPOINTS
+  USB_MIDI_FAST_INTERFACE(USB_HS_BULK_SIZE),
+#endif
   /* Terminator */
   0
 };
@@ -51,8 +51,23 @@
 #define BCD_DEVICE ((SW_VERSION_MAJOR << 8) | (SW_VERSION_MINOR_H << 4) | SW_VERSION_MINOR_L)
 /** @} */
 
+/** Number of virtual MIDI cables, each an embedded/external jack pair per direction */
+#ifndef USB_MIDI_CABLES
+#define USB_MIDI_CABLES (1)
+#endif
+#if USB_MIDI_CABLES < 1 || USB_MIDI_CABLES > 4
+#error "USB_MIDI_CABLES must be 1...4"
+#endif
+
+/** MIDI Streaming interfaces : the main one, and the fast lane's with an endpoint pair of its own */
+#ifdef FAST_LANE_ENDPOINTS
+#define USB_MIDI_INTERFACES (2)
+#else
+#define USB_MIDI_INTERFACES (1)
+#endif
+
 /** Size of the configuration block */
-#define CONFIG_BLOCK_SIZE 0x0065
+#define CONFIG_BLOCK_SIZE (0x0023 + USB_MIDI_INTERFACES + USB_CS_MIDI_STREAMING_TOTAL + USB_FAST_LANE_BLOCK_SIZE)
 /** Size of standard Audio endpoint descriptor */
 #define USB_AUDIO_ENDPOINT_DESC_SIZE 0x09
 
@@ -93,20 +108,29 @@
 /** Size of class-specific descriptors
  * @{
  */
-/** Size of CS Audio Control header interface descriptor */
-#define USB_CS_AUDIO_CONTROL_SIZE 0x09
+/** Size of CS Audio Control header interface descriptor, with its list of MIDI Streaming interfaces */
+#define USB_CS_AUDIO_CONTROL_SIZE (0x08 + USB_MIDI_INTERFACES)
 /** Total size of CS Audio Control interface descriptors */
-#define USB_CS_AUDIO_CONTROL_TOTAL 0x0009
+#define USB_CS_AUDIO_CONTROL_TOTAL USB_CS_AUDIO_CONTROL_SIZE
 /** Size of CS MIDI Streaming header interface descriptor */
 #define USB_CS_MIDI_STREAMING_SIZE 0x07
-/** Total size of CS MIDI Streaming interface descriptors */
-#define USB_CS_MIDI_STREAMING_TOTAL 0x0041
+/** Total size of CS MIDI Streaming interface descriptors, including the endpoint descriptors */
+#define USB_CS_MIDI_STREAMING_TOTAL (USB_CS_MIDI_STREAMING_SIZE + USB_MIDI_CABLES * USB_MIDI_JACKS_SIZE + 2 * (USB_AUDIO_ENDPOINT_DESC_SIZE + USB_MIDI_ENDPOINT_DESC_SIZE))
 /** Size of MIDI IN jack descriptor */
 #define USB_MIDI_IN_JACK_SIZE 0x06
 /** Size of MIDI OUT jack descriptor */
 #define USB_MIDI_OUT_JACK_SIZE 0x09
-/** Size of MIDI Streaming endpoint descriptor */
-#define USB_MIDI_ENDPOINT_DESC_SIZE 0x05
+/** Size of the jack descriptors of one cable */
+#define USB_MIDI_JACKS_SIZE (2 * USB_MIDI_IN_JACK_SIZE + 2 * USB_MIDI_OUT_JACK_SIZE)
+/** Size of MIDI Streaming endpoint descriptor, with its list of associated jacks */
+#define USB_MIDI_ENDPOINT_DESC_SIZE (0x04 + USB_MIDI_CABLES)
+/** Size of the fast lane's interface, one cable */
+#ifdef FAST_LANE_ENDPOINTS
+#define USB_CS_FAST_STREAMING_TOTAL (USB_CS_MIDI_STREAMING_SIZE + USB_MIDI_JACKS_SIZE + 2 * (USB_AUDIO_ENDPOINT_DESC_SIZE + 0x05))
+#define USB_FAST_LANE_BLOCK_SIZE    (USB_INTERFACE_DESC_SIZE + USB_CS_FAST_STREAMING_TOTAL)
+#else
+#define USB_FAST_LANE_BLOCK_SIZE (0)
+#endif
 /** @} */
 
 /** USB MIDI jack types
@@ -134,6 +158,10 @@
 #define MIDI_EP_OUT 0x01
 /** Bulk IN endpoint  - 0x02 */
 #define MIDI_EP_IN 0x02
+/** Fast lane bulk OUT endpoint - 0x02, the direction left free by MIDI_EP_IN */
+#define MIDI_EP_FAST_OUT 0x02
+/** Fast lane bulk IN endpoint  - 0x01, the direction left free by MIDI_EP_OUT */
+#define MIDI_EP_FAST_IN 0x01
 /** @} */
 
 extern const uint8_t USB0_MIDI_DeviceDescriptor[];
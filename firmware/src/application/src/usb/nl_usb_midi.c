@@ -16,53 +16,146 @@
 typedef struct
 {
   MidiReceiveComplete_Callback ReceiveCallback;
+  MidiSendComplete_Callback    SendCallback;
   int                          suspendReceive;
-  int                          primed;
+  unsigned                     primed;  // slots queued for reception, starting at head
+  unsigned                     head;    // slot the next finished transfer is received into
+  unsigned                     filled;  // slots handed to the application and not yet released
+#ifdef FAST_LANE_ENDPOINTS
+  MidiReceiveComplete_Callback FastReceiveCallback;
+  MidiSendComplete_Callback    FastSendCallback;
+  unsigned                     fastPrimed;
+  unsigned                     fastHead;
+  unsigned                     fastFilled;
+#endif
 } UsbMidi_t;
 
+// only accessed at the priority level of the USB interrupts (which the relay's SysTick work shares), so unguarded
 static UsbMidi_t usbMidi[2];
 
-// buffer sizes must match the values set up in the configuration descriptors !
-static uint8_t rxBuffer0[USB_HS_BULK_SIZE] __attribute__((aligned(4)));
-static uint8_t rxBuffer1[USB_FS_BULK_SIZE] __attribute__((aligned(4)));
+// buffer sizes must be multiples of the values set up in the configuration descriptors !
+static uint8_t rxBuffer0[USB_MIDI_RX_SLOTS][USB_MIDI_RX_SIZE_HS] __attribute__((aligned(4))) __attribute__((section(".noinit.$RamAHB32")));
+static uint8_t rxBuffer1[USB_MIDI_RX_SLOTS_FS][USB_MIDI_RX_SIZE_FS] __attribute__((aligned(4))) __attribute__((section(".noinit.$RamAHB32")));
 
-struct _rxBuffer
+static struct _rxBuffer
 {
   uint8_t *data;
   uint16_t size;
-} static rxBuffer[2] = {
+  uint16_t slots;
+} rxBuffer[2] = {
   {
-      .data = rxBuffer0,
-      .size = sizeof rxBuffer0,
+      .data  = &rxBuffer0[0][0],
+      .size  = USB_MIDI_RX_SIZE_HS,
+      .slots = USB_MIDI_RX_SLOTS,
   },
   {
-      .data = rxBuffer1,
-      .size = sizeof rxBuffer1,
+      .data  = &rxBuffer1[0][0],
+      .size  = USB_MIDI_RX_SIZE_FS,
+      .slots = USB_MIDI_RX_SLOTS_FS,
   },
 };
 
+#ifdef FAST_LANE_ENDPOINTS
+// fast lane receive buffers, one max size packet each
+static uint8_t fastRxBuffer0[USB_MIDI_FAST_SLOTS][USB_HS_BULK_SIZE] __attribute__((aligned(4))) __attribute__((section(".noinit.$RamAHB32")));
+static uint8_t fastRxBuffer1[USB_MIDI_FAST_SLOTS][USB_FS_BULK_SIZE] __attribute__((aligned(4))) __attribute__((section(".noinit.$RamAHB32")));
+
+static inline uint8_t *fastSlotData(uint8_t const port, unsigned const slot)
+{
+  return (port == 0) ? fastRxBuffer0[slot] : fastRxBuffer1[slot];
+}
+
+static inline uint32_t fastSlotSize(uint8_t const port)
+{
+  return (port == 0) ? USB_HS_BULK_SIZE : USB_FS_BULK_SIZE;
+}
+#endif
+
+static inline uint8_t *slotData(uint8_t const port, unsigned const slot)
+{
+  return rxBuffer[port].data + slot * rxBuffer[port].size;
+}
+
+static inline void resetRing(uint8_t const port)
+{
+  usbMidi[port].primed = 0;
+  usbMidi[port].head   = 0;
+  usbMidi[port].filled = 0;
+#ifdef FAST_LANE_ENDPOINTS
+  usbMidi[port].fastPrimed = 0;
+  usbMidi[port].fastHead   = 0;
+  usbMidi[port].fastFilled = 0;
+#endif
+}
+
 /******************************************************************************/
 /** @brief		Endpoint 1 Callback (Data read from Host)
+				With the fast lane its IN direction is the fast lane's transmit.
     @param[in]	event	Event that triggered the interrupt
 *******************************************************************************/
 
 static inline void primeReceive(uint8_t const port)
 {
   if (!usbMidi[port].suspendReceive)
+  {  // queue all free slots so back-to-back packets are received without software round-trips
+    while (usbMidi[port].primed + usbMidi[port].filled < rxBuffer[port].slots)
+    {
+      unsigned slot = (usbMidi[port].head + usbMidi[port].primed) % rxBuffer[port].slots;
+      if (!USB_ReadReqEP(port, 0x01, slotData(port, slot), rxBuffer[port].size))
+        break;  // no transfer descriptor available
+      usbMidi[port].primed++;
+    }
+  }
+}
+
+#ifdef FAST_LANE_ENDPOINTS
+static inline void primeFastReceive(uint8_t const port)
+{
+  while (usbMidi[port].fastPrimed + usbMidi[port].fastFilled < USB_MIDI_FAST_SLOTS)
   {
-    if (!usbMidi[port].primed)
+    unsigned slot = (usbMidi[port].fastHead + usbMidi[port].fastPrimed) % USB_MIDI_FAST_SLOTS;
+    if (!USB_ReadReqEP(port, USB_ENDPOINT_OUT(MIDI_EP_FAST_OUT), fastSlotData(port, slot), fastSlotSize(port)))
+      break;
+    usbMidi[port].fastPrimed++;
+  }
+}
+
+// same as the main receive, with no free slot the host is NAKed
+static void Handler_FastReadFromHost(uint8_t const port, uint32_t const event)
+{
+  switch (event)
+  {
+    case USB_EVT_OUT_NAK:
+      primeFastReceive(port);
+      break;
+
+    case USB_EVT_OUT:
     {
-      USB_ReadReqEP(port, 0x01, rxBuffer[port].data, rxBuffer[port].size);
-      usbMidi[port].primed = 1;
+      if (!usbMidi[port].fastPrimed)
+        break;  // stale transfer from before the ring was cleared
+      uint32_t length          = USB_ReadEP(port, USB_ENDPOINT_OUT(MIDI_EP_FAST_OUT));
+      uint8_t *data            = fastSlotData(port, usbMidi[port].fastHead);
+      usbMidi[port].fastHead   = (usbMidi[port].fastHead + 1) % USB_MIDI_FAST_SLOTS;
+      usbMidi[port].fastPrimed = usbMidi[port].fastPrimed - 1;
+      usbMidi[port].fastFilled = usbMidi[port].fastFilled + 1;
+      // slot belongs to the application until it calls USB_MIDI_ReleaseFastReceive()
+      if (usbMidi[port].FastReceiveCallback)
+        usbMidi[port].FastReceiveCallback(port, data, length);
+      else
+        usbMidi[port].fastFilled = usbMidi[port].fastFilled - 1;
+      primeFastReceive(port);
+      break;
     }
   }
 }
+#endif
 
 void USB_MIDI_primeReceive(uint8_t const port)
 {
-  __disable_irq();
   primeReceive(port);
-  __enable_irq();
+#ifdef FAST_LANE_ENDPOINTS
+  primeFastReceive(port);
+#endif
 }
 
 static void Handler_ReadFromHost(uint8_t const port, uint32_t const event)
@@ -75,51 +168,97 @@ static void Handler_ReadFromHost(uint8_t const port, uint32_t const event)
 
     case USB_EVT_OUT:  // transfer finished successfully --> hand data over to application
     {
-      uint32_t length = USB_ReadEP(port, 0x01);
+      if (!usbMidi[port].primed)
+        break;  // stale transfer from before the ring was cleared
+      uint32_t length      = USB_ReadEP(port, 0x01);
+      uint8_t *data        = slotData(port, usbMidi[port].head);
+      usbMidi[port].head   = (usbMidi[port].head + 1) % rxBuffer[port].slots;
+      usbMidi[port].primed = usbMidi[port].primed - 1;
+      usbMidi[port].filled = usbMidi[port].filled + 1;
+      // slot belongs to the application until it calls USB_MIDI_ReleaseReceive()
       if (usbMidi[port].ReceiveCallback)
-      {
-        usbMidi[port].ReceiveCallback(port, rxBuffer[port].data, length);
-        usbMidi[port].primed = 0;
-      }
+        usbMidi[port].ReceiveCallback(port, data, length);
+      else
+        usbMidi[port].filled = usbMidi[port].filled - 1;
       // prepare the next potential transfer right now to avoid extra NAK phase later
       primeReceive(port);
       break;
     }
+
+#ifdef FAST_LANE_ENDPOINTS
+    case USB_EVT_IN:  // a fast lane transmit has finished
+      if (usbMidi[port].FastSendCallback)
+        usbMidi[port].FastSendCallback(port);
+      break;
+#endif
   }
 }
 
 static void EndPoint1_ReadFromHost_0(uint8_t const port, uint32_t const event)
 {
+  (void) port;
   Handler_ReadFromHost(0, event);
 }
 
 static void EndPoint1_ReadFromHost_1(uint8_t const port, uint32_t const event)
 {
+  (void) port;
   Handler_ReadFromHost(1, event);
 }
 
+/******************************************************************************/
+/** @brief		Endpoint 2 Callback (Data written to Host)
+				With the fast lane its OUT direction is the fast lane's receive.
+    @param[in]	event	Event that triggered the interrupt
+*******************************************************************************/
+static void Handler_WriteToHost(uint8_t const port, uint32_t const event)
+{
+#ifdef FAST_LANE_ENDPOINTS
+  if (event == USB_EVT_OUT || event == USB_EVT_OUT_NAK)
+  {
+    Handler_FastReadFromHost(port, event);
+    return;
+  }
+#endif
+  if (event == USB_EVT_IN && usbMidi[port].SendCallback)  // a transmit has finished
+    usbMidi[port].SendCallback(port);
+}
+
+static void EndPoint2_WriteToHost_0(uint8_t const port, uint32_t const event)
+{
+  (void) port;
+  Handler_WriteToHost(0, event);
+}
+
+static void EndPoint2_WriteToHost_1(uint8_t const port, uint32_t const event)
+{
+  (void) port;
+  Handler_WriteToHost(1, event);
+}
+
 /******************************************************************************/
 /** @brief    Function that initializes USB MIDI driver for USB0 controller
 *******************************************************************************/
 void USB_MIDI_Init(uint8_t const port)
 {
   usbMidi[port].suspendReceive = 0;
-  usbMidi[port].primed         = 0;
+  resetRing(port);
   /** assign descriptors */
-  USB_Core_Device_Descriptor_Set(port, (const uint8_t *) (port == 0) ? USB0_MIDI_DeviceDescriptor : USB1_MIDI_DeviceDescriptor);
+  USB_Core_Device_Descriptor_Set(port, (const uint8_t *) ((port == 0) ? USB0_MIDI_DeviceDescriptor : USB1_MIDI_DeviceDescriptor));
   USB_Core_Device_FS_Descriptor_Set(port, (const uint8_t *) USB_MIDI_FSConfigDescriptor);
   USB_Core_Device_HS_Descriptor_Set(port, (const uint8_t *) USB_MIDI_HSConfigDescriptor);
-  USB_Core_Device_String_Descriptor_Set(port, (const uint8_t *) (port == 0) ? USB0_MIDI_StringDescriptor : USB1_MIDI_StringDescriptor);
+  USB_Core_Device_String_Descriptor_Set(port, (const uint8_t *) ((port == 0) ? USB0_MIDI_StringDescriptor : USB1_MIDI_StringDescriptor));
   USB_Core_Device_Device_Quali_Descriptor_Set(port, (const uint8_t *) USB_MIDI_DeviceQualifier);
   /** assign callbacks */
   USB_Core_Endpoint_Callback_Set(port, 1, (port == 0) ? EndPoint1_ReadFromHost_0 : EndPoint1_ReadFromHost_1);
+  USB_Core_Endpoint_Callback_Set(port, 2, (port == 0) ? EndPoint2_WriteToHost_0 : EndPoint2_WriteToHost_1);
   USB_Core_Init(port);
 }
 
 void USB_MIDI_DeInit(uint8_t const port)
 {
   usbMidi[port].suspendReceive = 0;
-  usbMidi[port].primed         = 0;
+  resetRing(port);
   USB_Core_DeInit(port);
   USB_Core_DeInit(port);
 }
@@ -134,6 +273,30 @@ void USB_MIDI_Config(uint8_t const port, MidiReceiveComplete_Callback midircv)
   usbMidi[port].ReceiveCallback = midircv;
 }
 
+/******************************************************************************/
+/** @brief    Function that sets the callback for finished transmits
+ *  @param[in]	midisent	Pointer to the callback function, called
+ *  						from interrupt context for each finished transmit
+*******************************************************************************/
+void USB_MIDI_ConfigSend(uint8_t const port, MidiSendComplete_Callback midisent)
+{
+  usbMidi[port].SendCallback = midisent;
+}
+
+#ifdef FAST_LANE_ENDPOINTS
+/******************************************************************************/
+/** @brief    Function that sets the callbacks of the fast lane endpoints
+ *  @param[in]	fastrcv		called for each received transfer, the slot has
+ *  						to be handed back with USB_MIDI_ReleaseFastReceive()
+ *  @param[in]	fastsent	called for each finished transmit
+*******************************************************************************/
+void USB_MIDI_ConfigFast(uint8_t const port, MidiReceiveComplete_Callback fastrcv, MidiSendComplete_Callback fastsent)
+{
+  usbMidi[port].FastReceiveCallback = fastrcv;
+  usbMidi[port].FastSendCallback    = fastsent;
+}
+#endif
+
 /******************************************************************************/
 /** @brief		Checks whether the USB-MIDI is connected and configured
     @return		1 - Success ; 0 - Failure
@@ -166,6 +329,31 @@ int32_t USB_MIDI_Send(uint8_t const port, uint8_t const *const buff, uint32_t co
   return -1;
 }
 
+#ifdef FAST_LANE_ENDPOINTS
+/******************************************************************************/
+/** @brief		Send a buffer on the fast lane endpoint
+    @return		Number of bytes written - Success ; -1 - Failure
+*******************************************************************************/
+int32_t USB_MIDI_SendFast(uint8_t const port, uint8_t const *const buff, uint32_t const cnt)
+{
+  if (USB_Core_ReadyToWrite(port, USB_ENDPOINT_IN(MIDI_EP_FAST_IN)))
+  {
+    if (cnt)
+      USB_WriteEP(port, USB_ENDPOINT_IN(MIDI_EP_FAST_IN), (uint8_t *) buff, (uint32_t) cnt);
+    return cnt;
+  }
+  return -1;
+}
+
+/******************************************************************************/
+/** @brief		Kill any active fast lane transmit
+*******************************************************************************/
+void USB_MIDI_KillFastTransmit(uint8_t const port)
+{
+  USB_ResetEP(port, USB_ENDPOINT_IN(MIDI_EP_FAST_IN));
+}
+#endif
+
 /******************************************************************************/
 /** @brief		Get the amount of bytes left to be sent
     @return		Amount of bytes to be sent from the buffer
@@ -175,6 +363,15 @@ int32_t USB_MIDI_BytesToSend(uint8_t const port)
   return USB_Core_BytesToSend(port, 0x82);
 }
 
+/******************************************************************************/
+/** @brief		Get the number of transmits queued and not yet finished
+    @return		Number of pending transmits
+*******************************************************************************/
+uint32_t USB_MIDI_PendingSends(uint8_t const port)
+{
+  return USB_Core_PendingTransfers(port, 0x82);
+}
+
 /******************************************************************************/
 /** @brief		Suspend further receives
     @param[in]	suspend	!= 0 --> suspended, == 0 --> normal
@@ -192,9 +389,52 @@ void USB_MIDI_KillTransmit(uint8_t const port)
   USB_ResetEP(port, 0x82);
 }
 
+/******************************************************************************/
+/** @brief		Hand the oldest received buffer back to the driver
+    @details	Buffers passed to the receive callback must be released in the
+				order they were received, once their data is no longer needed.
+*******************************************************************************/
+void USB_MIDI_ReleaseReceive(uint8_t const port)
+{
+  if (usbMidi[port].filled)
+    usbMidi[port].filled = usbMidi[port].filled - 1;
+  primeReceive(port);
+}
+
+#ifdef FAST_LANE_ENDPOINTS
+/******************************************************************************/
+/** @brief		Hand the oldest received fast lane buffer back to the driver
+*******************************************************************************/
+void USB_MIDI_ReleaseFastReceive(uint8_t const port)
+{
+  if (usbMidi[port].fastFilled)
+    usbMidi[port].fastFilled = usbMidi[port].fastFilled - 1;
+  primeFastReceive(port);
+}
+#endif
+
+/******************************************************************************/
+/** @brief		Hand over data stuck in a partially filled receive buffer
+    @details	A buffer spans several bulk packets and normally finishes on a
+				short packet. When the host stops right after a full packet the
+				data would sit there, so this should be called once per ticker
+				period : the buffer is handed to the receive callback as soon
+				as no more data has come in since the previous call.
+				Must be called at the priority level of the USB interrupts.
+*******************************************************************************/
+void USB_MIDI_CheckReceive(uint8_t const port)
+{
+  if (usbMidi[port].primed)
+    USB_HarvestEP(port, 0x01);
+#ifdef FAST_LANE_ENDPOINTS
+  if (usbMidi[port].fastPrimed)
+    USB_HarvestEP(port, USB_ENDPOINT_OUT(MIDI_EP_FAST_OUT));
+#endif
+}
+
 void USB_MIDI_ClearReceive(uint8_t const port)
 {
-  usbMidi[port].primed = 0;
+  resetRing(port);
 }
 
 // EOF
@@ -9,6 +9,23 @@
 #pragma once
 
 #include "nl_usbd.h"
+#include "usb/nl_usb_descmidi.h"
+
+// number of receive buffers per port, allows receiving while previous packets are still being relayed.
+// 2 keeps the throughput to a host reading in bursts, each further one only adds latency, see README.md
+#ifndef USB_MIDI_RX_SLOTS
+#define USB_MIDI_RX_SLOTS (2)
+#endif
+// FS port gets as many of its small buffers as needed to hold the same amount of data
+#define USB_MIDI_RX_SLOTS_FS (USB_MIDI_RX_SLOTS * (USB_HS_BULK_SIZE / USB_FS_BULK_SIZE))
+// number of max size bulk packets collected into one receive buffer, a short packet ends it early
+#ifndef USB_MIDI_RX_PACKETS
+#define USB_MIDI_RX_PACKETS (4)
+#endif
+#define USB_MIDI_RX_SIZE_HS (USB_MIDI_RX_PACKETS * USB_HS_BULK_SIZE)
+#define USB_MIDI_RX_SIZE_FS (USB_MIDI_RX_PACKETS * USB_FS_BULK_SIZE)
+// receive buffers of the fast lane endpoint per port, one max size bulk packet each
+#define USB_MIDI_FAST_SLOTS (2)
 
 /* Definition for Midi Callback functions */
 typedef void (*MidiReceiveComplete_Callback)(uint8_t const port, uint8_t* buff, uint32_t len);
@@ -18,12 +35,23 @@ typedef void (*MidiSendComplete_Callback)(uint8_t const port);
 void USB_MIDI_Init(uint8_t const port);
 void USB_MIDI_DeInit(uint8_t const port);
 void USB_MIDI_Config(uint8_t const port, MidiReceiveComplete_Callback midircv);
+void USB_MIDI_ConfigSend(uint8_t const port, MidiSendComplete_Callback midisent);
 
 uint32_t USB_MIDI_IsConfigured(uint8_t const port);
 uint32_t USB_MIDI_ConfigStatus(uint8_t const port);
 void     USB_MIDI_SuspendReceive(uint8_t const port, uint8_t const suspend);
 void     USB_MIDI_primeReceive(uint8_t const port);
+void     USB_MIDI_ReleaseReceive(uint8_t const port);
+void     USB_MIDI_CheckReceive(uint8_t const port);
 void     USB_MIDI_ClearReceive(uint8_t const port);
 int32_t  USB_MIDI_Send(uint8_t const port, uint8_t const* const buff, uint32_t const cnt);
 int32_t  USB_MIDI_BytesToSend(uint8_t const port);
+uint32_t USB_MIDI_PendingSends(uint8_t const port);
 void     USB_MIDI_KillTransmit(uint8_t const port);
+
+#ifdef FAST_LANE_ENDPOINTS
+void    USB_MIDI_ConfigFast(uint8_t const port, MidiReceiveComplete_Callback fastrcv, MidiSendComplete_Callback fastsent);
+int32_t USB_MIDI_SendFast(uint8_t const port, uint8_t const* const buff, uint32_t const cnt);
+void    USB_MIDI_KillFastTransmit(uint8_t const port);
+void    USB_MIDI_ReleaseFastReceive(uint8_t const port);
+#endif
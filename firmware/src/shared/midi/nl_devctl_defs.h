@@ -20,6 +20,59 @@
 #define CMD_LED_TEST_H (0x01)  // ... for all colors (also for alignment during assembly
 #define CMD_LED_TEST   ((CMD_LED_TEST_H << 8) | CMD_LED_TEST_L)
 
+#define CMD_ECHO_L (0x03)  // command 0x0103 : echo mode for the port it is received on, one data byte, 1 --> on ...
+#define CMD_ECHO_H (0x01)  // ... every packet is sent back on the same port, 0 --> off, normal relaying
+#define CMD_ECHO   ((CMD_ECHO_H << 8) | CMD_ECHO_L)
+
+#define CMD_PING_L (0x04)  // command 0x0104 : the message, including any data bytes, ...
+#define CMD_PING_H (0x01)  // ... is sent back unchanged on the same port, right from the receive interrupt
+#define CMD_PING   ((CMD_PING_H << 8) | CMD_PING_L)
+
+#define CMD_GENERATE_L (0x05)  // command 0x0105 : perf-test traffic sent on the port it is received on, data bytes are ...
+#define CMD_GENERATE_H (0x01)  // ... on (1) or off (0), block size and messages per second (0 --> max), low 7 bits first
+#define CMD_GENERATE   ((CMD_GENERATE_H << 8) | CMD_GENERATE_L)
+
+#define CMD_SHAPE_L (0x06)  // command 0x0106 : limit what is sent on the port it is received on, data bytes are bytes per ...
+#define CMD_SHAPE_H (0x01)  // ... second (21 bits, 0 --> no limit) and burst size (14 bits, 0 --> 512), low 7 bits first
+#define CMD_SHAPE   ((CMD_SHAPE_H << 8) | CMD_SHAPE_L)
+
+#define CMD_STATS_L (0x07)  // command 0x0107 : no data bytes, the bridge replies on the same port with the same message, ...
+#define CMD_STATS_H (0x01)  // ... plus the counters of both directions, 8-to-7 encoded like MIDI_encodeSysex() does
+#define CMD_STATS   ((CMD_STATS_H << 8) | CMD_STATS_L)
+
+// the counters of a CMD_STATS reply : per direction, the one coming in on port 0 first, 32-bit values, little endian.
+// The reply goes out in the bridge's priority lane of 64 event packets, which leaves room for 19 fields at most
+#define STATS_PACKETS          (0)   // bulk packets forwarded
+#define STATS_BYTES            (1)   // bytes forwarded, bulk, urgent and fast lane
+#define STATS_URGENT_EVENTS    (2)   // real-time and channel event packets forwarded in the priority lane
+#define STATS_DROPPED          (3)   // packets dropped or dismissed, PACKET_DROPPED of the LED state monitor
+#define STATS_DROPPED_INCOMING (4)   // packets dismissed as the outgoing port was offline, DROPPED_INCOMING
+#define STATS_LATE             (5)   // packets delivered in SMON_LATE_TIME_US up to SMON_STALE_TIME_US from transmit start ...
+#define STATS_STALE            (6)   // ... and in SMON_STALE_TIME_US or longer
+#define STATS_TIMEOUTS         (7)   // transfers the outgoing host did not take within the packet timeout
+#define STATS_MALFORMED        (8)   // malformed event packets received
+#define STATS_MAX_DWELL_US     (9)   // longest time a bulk packet was queued, reception to delivery ...
+#define STATS_MAX_URGENT_US    (10)  // ... and an urgent event packet
+#define STATS_USB_ERRORS       (11)  // USB errors that restarted the controller of the incoming port
+#define STATS_SHAPER_HOLDS     (12)  // times transmits to the incoming port's host started to be held back by its shaper, CMD_SHAPE ...
+#define STATS_SHAPER_HELD_US   (13)  // ... and the time they were
+#define STATS_ARENA_PEAK       (14)  // most bytes the direction held in the LOSSLESS_BUFFERING arena at a time ...
+#define STATS_ARENA_FAILED     (15)  // ... packets that did not fit into it ...
+#define STATS_ARENA_TOTAL_PEAK (16)  // ... and the most both directions held together, the same for both
+#define STATS_RECOVERY_LAST_US (17)  // time the host took to configure the incoming port again after the last USB error ...
+#define STATS_RECOVERY_MAX_US  (18)  // ... and the longest such time
+#define STATS_FIELDS           (19)
+
+#define CMD_HISTOGRAM_L (0x08)  // command 0x0108 : data bytes are a port, a phase and 1 --> reset it after reading. The ...
+#define CMD_HISTOGRAM_H (0x01)  // ... bridge replies like to CMD_STATS with the latency histogram of the direction coming in on the port
+#define CMD_HISTOGRAM   ((CMD_HISTOGRAM_H << 8) | CMD_HISTOGRAM_L)
+
+// latency histograms of CMD_HISTOGRAM : HIST_BUCKETS 32-bit counts, little endian, of delays in 125us ticks.
+// Bucket 0 counts 0 ticks, bucket n 2^(n-1) up to 2^n - 1 ticks, the last one anything longer
+#define HIST_PHASE_WAIT (0)  // from reception until the transmit is queued : waiting for the outgoing host to take the ones before
+#define HIST_PHASE_WIRE (1)  // from then until the outgoing host has taken the transmit
+#define HIST_BUCKETS    (16)
+
 // The ID is mandatory after each 0xF0 sysex start so that other devices will
 // ignore the sysex properly in case it actually reaches the device. This can happen
 // for example in the fw-uploader which issues an INFO request before it continue
@@ -32,6 +85,10 @@
 // depending on the command optional data bytes might follow, which may
 // or may not be encoded 8-bit source data, the command parser is in charge for that
 
+// CMD_ECHO, CMD_PING, CMD_GENERATE, CMD_SHAPE, CMD_STATS and CMD_HISTOGRAM are also taken while relaying, when a received
+// transfer starts with them. The events behind the command's SysEx in the same transfer are relayed as usual.
+// Anything else after the first message is relayed as normal SysEx.
+
 // "\0NL"
 // sysex: f0 00 4e 4c 01 44 43 ...
 static const uint8_t NLMB_DevCtlSignature[] = {
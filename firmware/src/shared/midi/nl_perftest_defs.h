@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+// payload of a perf-test message, 8-to-7 encoded into one SysEx right after the F0 :
+// a header of 64-bit fields, then a 16-bit counter pattern starting at the message number
+#define PERF_FIELD_TIME    (0)  // sender's time in usecs
+#define PERF_FIELD_NUMBER  (1)  // message number
+#define PERF_FIELD_SIZE    (2)  // payload bytes, including the header
+#define PERF_FIELD_MAGIC   (3)  // PERF_STAMP_MAGIC --> the bridge may stamp the next two fields, see PERF_TIMESTAMPS
+#define PERF_FIELD_INGRESS (4)  // bridge's time in usecs when it received the message, 0 --> not stamped
+#define PERF_FIELD_EGRESS  (5)  // ... and when it queued it for transmit
+#define PERF_HEADER_SIZE   (6 * 8)
+
+#define PERF_STAMP_MAGIC (0x53504D4154534C4Eull)  // "NLSTAMPS" in memory, little endian
+
+// encoded SysEx bytes from the F0 up to and including the last header byte
+#define PERF_HEADER_ENCODED (1 + (PERF_HEADER_SIZE / 7) * 8 + 1 + (PERF_HEADER_SIZE % 7))
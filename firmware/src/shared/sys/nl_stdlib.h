@@ -10,18 +10,19 @@
 #include <stdint.h>
 #include <stddef.h>
 
-static inline void *memset(void *const pMem, uint8_t const c, size_t n)
+static inline void *memset(void *const pMem, int const c, size_t n)
 {
   uint8_t *p = (uint8_t *) pMem;
   while (n--)
-    *(p++) = c;
+    *(p++) = (uint8_t) c;
   return pMem;
 }
 
-static inline void *memcpy(void *dest, void *src, size_t n)
+static inline void *memcpy(void *dest, void const *src, size_t n)
 {
-  uint8_t *p = (uint8_t *) dest;
+  uint8_t       *p = (uint8_t *) dest;
+  uint8_t const *q = (uint8_t const *) src;
   while (n--)
-    *(p++) = *((uint8_t *) src++);
+    *(p++) = *(q++);
   return dest;
 }
@@ -0,0 +1,145 @@
+// Host benchmark of the bridge's MIDI clock regeneration (firmware option CLOCK_REGEN_DELAY_US).
+// A clock source is simulated : 24 ticks per quarter at the given tempo, constant for the first half of the run
+// and ramping up by 25% in the second half, with random send jitter and quantized to 1ms USB frames on the way
+// in. The ticks are timestamped on the 125us ticker and run through the firmware's filter, which is polled once
+// per ticker period like the relay does. Reported is the jitter of the tick intervals before and after.
+// Optionally the relay's priority lane has no room for a while every second, ticks then wait in the filter,
+// and the exit code is 1 when not every tick came out.
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "midi/MIDI_clock.h"
+
+#define TICK_US  (125.0)   // firmware ticker period
+#define FRAME_US (1000.0)  // FS USB frame, the sending host's packets arrive on frame boundaries
+
+typedef struct
+{
+  unsigned count;
+  double   sum2;  // squared deviations from the ideal intervals
+  double   max;
+  double   last;  // time of the previous tick
+  double   lastIdeal;
+  double   latency;  // summed ideal time to tick time
+} Jitter_t;
+
+static void usage(void)
+{
+  printf(
+      "Usage: clock-jitter [bpm [jitter [delay [seconds [stall]]]]]\n"
+      "\n"
+      "bpm    : tempo at the start, default is 120\n"
+      "jitter : peak-to-peak send jitter of the clock source in microseconds, default is 2000\n"
+      "delay  : filter latency in microseconds, as CLOCK_REGEN_DELAY_US, default is 3000\n"
+      "seconds: length of the run, default is 60\n"
+      "stall  : milliseconds per second the priority lane has no room for ticks, default is 0\n");
+}
+
+static void addTick(Jitter_t *const j, double const time, double const ideal)
+{
+  if (j->count)
+  {
+    double const dev = fabs((time - j->last) - (ideal - j->lastIdeal));
+    j->sum2 += dev * dev;
+    if (dev > j->max)
+      j->max = dev;
+  }
+  j->latency += time - ideal;
+  j->last      = time;
+  j->lastIdeal = ideal;
+  j->count++;
+}
+
+static void report(char const *const name, Jitter_t const *const j)
+{
+  printf("%-7s: %6u ticks, interval jitter rms %7.1fus max %7.1fus, latency %7.1fus\n", name, j->count,
+         j->count > 1 ? sqrt(j->sum2 / (j->count - 1)) : 0.0, j->max, j->count ? j->latency / j->count : 0.0);
+}
+
+int main(int const argc, char const *const argv[])
+{
+  double   bpm     = 120;
+  double   jitter  = 2000;
+  double   delay   = 3000;
+  double   seconds = 60;
+  double   stall   = 0;
+  Jitter_t in      = { 0 };
+  Jitter_t out     = { 0 };
+
+  if (argc > 6 || (argc > 1 && !strcmp(argv[1], "-h")))
+  {
+    usage();
+    return 1;
+  }
+  if (argc > 1)
+    bpm = atof(argv[1]);
+  if (argc > 2)
+    jitter = atof(argv[2]);
+  if (argc > 3)
+    delay = atof(argv[3]);
+  if (argc > 4)
+    seconds = atof(argv[4]);
+  if (argc > 5)
+    stall = atof(argv[5]);
+  if (bpm <= 0 || jitter < 0 || delay < 0 || seconds <= 0 || stall < 0 || stall >= 1000)
+  {
+    usage();
+    return 1;
+  }
+
+  ClockFilter_t filter;
+  CLOCK_Init(&filter, (uint32_t)((delay + TICK_US / 2) / TICK_US));
+  srand(1);
+
+  double const end       = seconds * 1e6;
+  double       ideal     = 0;    // send time of the next tick without jitter
+  double       arrival   = 0;    // ... and when it reaches the bridge
+  double       lastIn    = -1;
+  double       pending[1024];  // ideal times of the ticks in the filter, those waiting for room included
+  unsigned     pendCount = 0;
+  uint64_t     now       = 0;
+
+  while (now * TICK_US < end)
+  {
+    while (arrival < (now + 1) * TICK_US)
+    {  // ticks received in this ticker period
+      if (arrival >= now * TICK_US)
+      {
+        addTick(&in, now * TICK_US, ideal);
+        CLOCK_Input(&filter, now);
+        if (pendCount < sizeof pending / sizeof pending[0])
+          pending[pendCount++] = ideal;
+      }
+      double const tempo = (ideal < end / 2) ? bpm : bpm * (1.0 + 0.5 * (ideal - end / 2) / end);
+      ideal += 60e6 / (tempo * 24);
+      double const sent = ideal + jitter * ((double) rand() / RAND_MAX - 0.5);
+      arrival           = ceil(sent / FRAME_US) * FRAME_US;
+      if (arrival <= lastIn)
+        arrival = lastIn + 1;  // order is kept
+      lastIn = arrival;
+    }
+    unsigned const room = (fmod(now * TICK_US, 1e6) < stall * 1000) ? 0 : CLOCK_PENDING;
+    for (unsigned n = CLOCK_Due(&filter, now, room); n; n--)
+    {
+      addTick(&out, now * TICK_US, pendCount ? pending[0] : ideal);
+      if (pendCount)
+        memmove(&pending[0], &pending[1], --pendCount * sizeof pending[0]);
+    }
+    now++;
+  }
+  for (unsigned n = CLOCK_Flush(&filter, CLOCK_PENDING + filter.overflow); n; n--)
+    addTick(&out, now * TICK_US, pendCount ? pending[--pendCount] : ideal);
+
+  printf("%.1f bpm ramping to %.1f bpm, %.0fus send jitter, %.0fus filter delay, %.0fs, %.0fms/s stalled\n", bpm, bpm * 1.25, jitter, delay, seconds, stall);
+  report("input", &in);
+  report("output", &out);
+  printf("resyncs: %u, smoothed period at the end %.1fus\n", filter.stats.resyncs, filter.stats.period * TICK_US / (1 << CLOCK_FRAC));
+  if (out.count != in.count || filter.stats.out != filter.stats.in)
+  {
+    printf("FAILED : %u ticks in, %u out\n", filter.stats.in, filter.stats.out);
+    return 1;
+  }
+  return 0;
+}
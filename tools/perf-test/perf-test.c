@@ -14,6 +14,8 @@
 #include <fcntl.h>
 #include <alsa/asoundlib.h>
 #include <inttypes.h>
+#include "midi/nl_devctl_defs.h"
+#include "midi/nl_perftest_defs.h"
 
 #define PAYLOAD_BUFFER_SIZE (100000ul)
 
@@ -23,6 +25,8 @@
 
 #define SEND_WAIT_MS (1ul)  // milliseconds to wait when send buffer is going to overrun
 
+#define PING_TIMEOUT_US (100000ul)  // a ping not answered within this time counts as lost
+
 #define DISPLAY_PERIOD (1000000u)
 #define MAX_DEGEN      (0.97)
 #define MIN_DEGEN      (0.97)
@@ -39,8 +43,18 @@ typedef enum
 
 static BOOL           send;   // flag for program function: 1-->send , 0-->receive
 static BOOL           local;  // flag for using local relative time
+static BOOL           ping;   // flag: measure the USB round trip with device control pings
+static BOOL           stats;  // flag: read the bridge's counters, see CMD_STATS
+static int            hist = -1;  // >= 0 : read the bridge's latency histograms, 1 --> and reset them, see CMD_HISTOGRAM
+static int            echo = -1;  // >= 0 : switch the echo mode of the port, see CMD_ECHO
+static BOOL           generate;   // flag: have the bridge send test data, see CMD_GENERATE
+static int            genRate;    // messages per second, 0 --> as fast as the host takes them
+static int            shapeRate = -1;  // >= 0 : limit what the bridge sends on the port, see CMD_SHAPE ...
+static int            shapeBurst;      // ... and the burst size, 0 --> the bridge's default
+static int            pings = 100;
 static char const *   pName;  // port name
 static snd_rawmidi_t *port;   // MIDI port
+static snd_rawmidi_t *inPort;  // its input as well, for ping and echo
 static BOOL           stop;
 static int            blkSize   = -1;
 static int            delayInUs = 1000;
@@ -68,10 +82,28 @@ static void usage(void)
 {
   printf(
       "Usage: perf-test -s|-r port [blksize [delay]]\n"
+      "       perf-test -p port [count]\n"
+      "       perf-test -e port on|off\n"
+      "       perf-test -g port blksize [rate] | off\n"
+      "       perf-test -l port bytes/s [burst] | off\n"
+      "       perf-test -c port\n"
+      "       perf-test -t port [reset]\n"
       "\n"
       "-s     : send test data\n"
       "-r     : receive test data\n"
       "-rl    : receive test data, use relative local time\n"
+      "-p     : ping the bridge, the USB round trip without any relaying\n"
+      "-e     : switch echo mode of the port, the bridge sends back what it receives on it.\n"
+      "         Run -s and -r on the same port then, to get the round trip through the relay\n"
+      "-g     : have the bridge send test data on the port, in the format of -s, until switched off.\n"
+      "         Receive it with -rl, the timestamps are the bridge's\n"
+      "-l     : limit the data rate the bridge sends on the port with, for hosts choking on bursts.\n"
+      "         burst is the number of bytes it may send at once after a pause, default is 512\n"
+      "-c     : read the traffic and drop counters of the bridge, both directions\n"
+      "-t     : read the latency histograms of the bridge, both directions, and reset them with 'reset'.\n"
+      "         'wait' is the time until a packet's transmit is queued, 'wire' until the host has taken it\n"
+      "rate   : messages per second, default is 0 --> as fast as the host takes them\n"
+      "count  : number of pings, default is 100\n"
       "port   : MIDI port to test (in hw:x,y,z notation, see ouput of 'amidi -l'\n"
       "blksize: fixed block size of data chunk, for send only\n"
       "         (also forces a constant <delay> sleep time between messages)\n"
@@ -96,6 +128,90 @@ static inline void getCmdLineParams(int const argc, char const *const argv[])
     send  = FALSE;
     local = TRUE;
   }
+  else if (strlen(argv[1]) == 2 && 0 == strcmp(argv[1], "-p"))
+  {
+    ping = TRUE;
+    if (argc >= 4 && ((1 != sscanf(argv[3], "%i", &pings)) || pings < 1))
+    {
+      error("illegal ping count\n");
+      usage();
+      exit(1);
+    }
+    pName = argv[2];
+    return;
+  }
+  else if (strlen(argv[1]) == 2 && 0 == strcmp(argv[1], "-c"))
+  {
+    stats = TRUE;
+    pName = argv[2];
+    return;
+  }
+  else if (strlen(argv[1]) == 2 && 0 == strcmp(argv[1], "-t"))
+  {
+    if (argc == 4 && strcmp(argv[3], "reset"))
+    {
+      error("illegal parameter '%s'\n", argv[3]);
+      usage();
+      exit(1);
+    }
+    hist  = (argc == 4);
+    pName = argv[2];
+    return;
+  }
+  else if (strlen(argv[1]) == 2 && 0 == strcmp(argv[1], "-e"))
+  {
+    if (argc != 4 || (strcmp(argv[3], "on") && strcmp(argv[3], "off")))
+    {
+      error("echo mode must be on or off\n");
+      usage();
+      exit(1);
+    }
+    echo  = !strcmp(argv[3], "on");
+    pName = argv[2];
+    return;
+  }
+  else if (strlen(argv[1]) == 2 && 0 == strcmp(argv[1], "-g"))
+  {
+    generate = TRUE;
+    pName    = argv[2];
+    if (argc == 4 && !strcmp(argv[3], "off"))
+      return;
+    if (argc < 4 || (1 != sscanf(argv[3], "%i", &blkSize)) || (blkSize < 0) || (blkSize > 976))
+    {
+      error("illegal block size (must be 0...976)\n");
+      usage();
+      exit(1);
+    }
+    if (argc > 4 && ((1 != sscanf(argv[4], "%i", &genRate)) || genRate < 0 || genRate > 16383))
+    {
+      error("illegal rate (must be 0...16383)\n");
+      usage();
+      exit(1);
+    }
+    return;
+  }
+  else if (strlen(argv[1]) == 2 && 0 == strcmp(argv[1], "-l"))
+  {
+    pName = argv[2];
+    if (argc == 4 && !strcmp(argv[3], "off"))
+    {
+      shapeRate = 0;
+      return;
+    }
+    if (argc < 4 || (1 != sscanf(argv[3], "%i", &shapeRate)) || (shapeRate < 1) || (shapeRate > 2097151))
+    {
+      error("illegal rate (must be 1...2097151)\n");
+      usage();
+      exit(1);
+    }
+    if (argc > 4 && ((1 != sscanf(argv[4], "%i", &shapeBurst)) || shapeBurst < 1 || shapeBurst > 16383))
+    {
+      error("illegal burst size (must be 1...16383)\n");
+      usage();
+      exit(1);
+    }
+    return;
+  }
   else
   {
     error("illegal parameter '%s'\n", argv[1]);
@@ -134,7 +250,9 @@ static inline void getCmdLineParams(int const argc, char const *const argv[])
 static inline void openPort(void)
 {
   int err;
-  if (send)
+  if (ping || stats || hist >= 0)
+    err = snd_rawmidi_open(&inPort, &port, pName, 0);
+  else if (send || echo >= 0 || shapeRate >= 0)
     err = snd_rawmidi_open(NULL, &port, pName, 0);  // send will be blocking
   else
     err = snd_rawmidi_open(&port, NULL, pName, SND_RAWMIDI_NONBLOCK);
@@ -148,6 +266,8 @@ static inline void openPort(void)
 static inline void closePort(void)
 {
   snd_rawmidi_close(port);
+  if (inPort)
+    snd_rawmidi_close(inPort);
 }
 
 #pragma GCC diagnostic push
@@ -257,8 +377,11 @@ static inline void doSend(void)
     if (runningCntr >= 128)
       runningCntr = 0;
 
-    ((uint64_t *) dataBuf)[0] = getTimeUSec();
-    ((uint64_t *) dataBuf)[1] = messageNo;
+    ((uint64_t *) dataBuf)[PERF_FIELD_TIME]    = getTimeUSec();
+    ((uint64_t *) dataBuf)[PERF_FIELD_NUMBER]  = messageNo;
+    ((uint64_t *) dataBuf)[PERF_FIELD_MAGIC]   = PERF_STAMP_MAGIC;
+    ((uint64_t *) dataBuf)[PERF_FIELD_INGRESS] = 0;
+    ((uint64_t *) dataBuf)[PERF_FIELD_EGRESS]  = 0;
 
     unsigned size;
     if (blkSize >= 0)
@@ -271,13 +394,13 @@ static inline void doSend(void)
     }
     if (size & 1)
       size++;
-    size += 24;
+    size += PERF_HEADER_SIZE;
 
-    ((uint64_t *) dataBuf)[2] = size;
+    ((uint64_t *) dataBuf)[PERF_FIELD_SIZE] = size;
 
-    uint16_t *p   = (uint16_t *) &(dataBuf[24]);
+    uint16_t *p   = (uint16_t *) &(dataBuf[PERF_HEADER_SIZE]);
     uint16_t  val = messageNo & 0xFFFF;
-    for (unsigned i = 0; i < (size - 24) / 2; i++)
+    for (unsigned i = 0; i < (size - PERF_HEADER_SIZE) / 2; i++)
       *p++ = val++;
 
     cursorUp(1);
@@ -418,21 +541,71 @@ uint64_t rcvTotalBytes     = 0;
 uint64_t rcvTime           = 0;
 uint64_t rcvLastPacketTime = 0;
 
+// latency split up with the bridge's timestamps, see PERF_TIMESTAMPS. The hosts' and the bridge's clocks
+// are not synchronized, so the host segments are shown above the lowest value seen, the bridge's as they are
+typedef struct
+{
+  int64_t min;
+  int64_t max;
+  int64_t sum;
+} Segment_t;
+
+static Segment_t segments[3] = { { INT64_MAX, INT64_MIN, 0 }, { INT64_MAX, INT64_MIN, 0 }, { INT64_MAX, INT64_MIN, 0 } };
+static uint32_t  segCnt;
+
+static inline void addSegment(Segment_t *const seg, int64_t const time)
+{
+  if (time < seg->min)
+    seg->min = time;
+  if (time > seg->max)
+    seg->max = time;
+  seg->sum += time;
+}
+
+static inline void splitLatency(uint64_t const sent, uint64_t const ingress, uint64_t const egress, uint64_t const received)
+{
+  addSegment(&segments[0], (int64_t)(ingress - sent));  // sending host, until the bridge has it
+  addSegment(&segments[1], (int64_t)(egress - ingress));  // in the bridge
+  addSegment(&segments[2], (int64_t)(received - egress));  // receiving host, until perf-test has it
+  if (++segCnt == 10000)
+  {
+    segCnt /= 2;
+    for (int i = 0; i < 3; i++)
+      segments[i].sum /= 2;
+  }
+}
+
+static inline void printSegments(void)
+{
+  if (!segCnt)
+  {
+    printf("(no bridge timestamps)\n");
+    return;
+  }
+  int64_t const offset[3] = { segments[0].min, 0, segments[2].min };
+  printf("host out %6.2lfms(avg) %6.2lfms(max)  bridge %6.2lfms(avg) %6.2lfms(max)  host in %6.2lfms(avg) %6.2lfms(max)\n",
+         (segments[0].sum / (double) segCnt - offset[0]) / 1000.0, (segments[0].max - offset[0]) / 1000.0,
+         (segments[1].sum / (double) segCnt - offset[1]) / 1000.0, (segments[1].max - offset[1]) / 1000.0,
+         (segments[2].sum / (double) segCnt - offset[2]) / 1000.0, (segments[2].max - offset[2]) / 1000.0);
+}
+
 static inline BOOL examineContent(void const *const data, unsigned const len)
 {
   static unsigned maxCntr = 0;
   static unsigned minCntr = 0;
 
   static uint64_t displayTime = 0;
-  if (len < 24)
+  if (len < PERF_HEADER_SIZE)
   {
-    error("receive: payload has wrong minimum length %d, expected %d", len, 16);
+    error("receive: payload has wrong minimum length %d, expected %d", len, PERF_HEADER_SIZE);
     return FALSE;
   }
 
-  uint64_t const packetTime   = ((uint64_t *) data)[0];
-  uint64_t const packetNumber = ((uint64_t *) data)[1];
-  uint64_t const packetSize   = ((uint64_t *) data)[2];
+  uint64_t const packetTime   = ((uint64_t *) data)[PERF_FIELD_TIME];
+  uint64_t const packetNumber = ((uint64_t *) data)[PERF_FIELD_NUMBER];
+  uint64_t const packetSize   = ((uint64_t *) data)[PERF_FIELD_SIZE];
+  uint64_t const ingress      = ((uint64_t *) data)[PERF_FIELD_INGRESS];
+  uint64_t const egress       = ((uint64_t *) data)[PERF_FIELD_EGRESS];
 
   if (packetSize != len)
   {
@@ -455,9 +628,9 @@ static inline BOOL examineContent(void const *const data, unsigned const len)
   printf("n:%" PRIu64 ", s:%5" PRIu64 "\n", packetNumber, packetSize);
   fflush(stdout);
 
-  uint16_t *p   = (uint16_t *) &(((uint64_t *) data)[3]);
+  uint16_t *p   = (uint16_t *) &(((uint8_t *) data)[PERF_HEADER_SIZE]);
   uint16_t  val = packetNumber & 0xFFFF;
-  for (unsigned i = 0; i < (packetSize - 24) / 2; i++)
+  for (unsigned i = 0; i < (packetSize - PERF_HEADER_SIZE) / 2; i++)
   {
     if (*p++ != val++)
     {
@@ -469,6 +642,8 @@ static inline BOOL examineContent(void const *const data, unsigned const len)
   uint64_t const now = getTimeUSec();
   if (rcvLastPacketTime == 0)
     rcvLastPacketTime = now;
+  if (ingress && egress)
+    splitLatency(packetTime, ingress, egress, now);
 
   uint64_t time;
 
@@ -498,7 +673,8 @@ static inline BOOL examineContent(void const *const data, unsigned const len)
   if (now > displayTime)
   {
     displayTime = now + DISPLAY_PERIOD;
-    cursorUp(2);
+    cursorUp(3);
+    printSegments();
     printf("%s%6.2lfms(min)" TTY_DEFAULT " %6.2lfms(avg) %s%6.2lfms(max) " TTY_DEFAULT " %s  %6.2lfkB/s\n\n",
            minCntr == 0 ? TTY_DEFAULT : (minCntr >= 6 ? TTY_RED : TTY_GREEN), ((double) min) / 1000.0,
            ((double) sum) / 1000.0 / cnt,
@@ -619,7 +795,7 @@ static inline void doReceive(void)
   snd_rawmidi_poll_descriptors(port, pfds, npfds);
   signal(SIGINT, sigHandler);
 
-  printf("Receiving data from port: %s\n\n\n", pName);
+  printf("Receiving data from port: %s\n\n\n\n", pName);
 
   do
   {
@@ -688,6 +864,273 @@ static inline void doReceive(void)
   fflush(stdout);
 }
 
+//
+// -------- device control : echo mode and ping --------
+//
+
+static int sendDevCtl(uint8_t const cmd, uint8_t const *const data, unsigned const len)
+{
+  uint8_t  msg[sizeof NLMB_DevCtlSignature + 2 + 16 + 1];
+  unsigned n = sizeof NLMB_DevCtlSignature;
+
+  memcpy(msg, NLMB_DevCtlSignature, n);
+  msg[n++] = cmd;
+  msg[n++] = 0x01;
+  memcpy(&msg[n], data, len);
+  n += len;
+  msg[n++] = 0xF7;
+  if (snd_rawmidi_write(port, msg, n) != (ssize_t) n || snd_rawmidi_drain(port) < 0)
+  {
+    error("cannot send device control message");
+    return 0;
+  }
+  return 1;
+}
+
+static inline void doEcho(void)
+{
+  uint8_t const mode = echo;
+  if (sendDevCtl(CMD_ECHO_L, &mode, 1))
+    printf("Echo mode of port %s is %s\n", pName, mode ? "on" : "off");
+}
+
+static inline void doGenerate(void)
+{
+  uint8_t const data[5] = { blkSize >= 0, blkSize & 0x7F, (blkSize >> 7) & 0x7F, genRate & 0x7F, (genRate >> 7) & 0x7F };
+  if (!sendDevCtl(CMD_GENERATE_L, data, sizeof data))
+    return;
+  if (blkSize < 0)
+    printf("Bridge stopped sending test data on port %s\n", pName);
+  else
+    printf("Bridge sends test data on port %s, block size %d, %d messages/s%s\n", pName, blkSize, genRate, genRate ? "" : " (max)");
+}
+
+static inline void doShape(void)
+{
+  uint8_t const data[5] = { shapeRate & 0x7F, (shapeRate >> 7) & 0x7F, (shapeRate >> 14) & 0x7F, shapeBurst & 0x7F, (shapeBurst >> 7) & 0x7F };
+  if (!sendDevCtl(CMD_SHAPE_L, data, sizeof data))
+    return;
+  if (shapeRate == 0)
+    printf("Bridge sends on port %s without a limit\n", pName);
+  else
+    printf("Bridge sends on port %s with %d bytes/s at most, bursts of %d bytes\n", pName, shapeRate, shapeBurst ? shapeBurst : 512);
+}
+
+// wait for the reply to a ping, returns the round trip time in usecs, 0 --> lost
+static uint64_t waitPong(uint8_t const *const data, unsigned const len, uint64_t const sent)
+{
+  uint8_t  reply[64];
+  unsigned pos = 0;
+
+  while (getTimeUSec() - sent < PING_TIMEOUT_US)
+  {
+    uint8_t byte;
+    ssize_t read = snd_rawmidi_read(inPort, &byte, 1);
+    if (read == -EAGAIN)
+    {
+      usleep(10);
+      continue;
+    }
+    if (read != 1)
+      return 0;
+    if (byte == 0xF0)
+      pos = 0;
+    if (pos < sizeof reply)
+      reply[pos++] = byte;
+    if (byte == 0xF7 && pos == sizeof NLMB_DevCtlSignature + 2 + len + 1 && reply[sizeof NLMB_DevCtlSignature] == CMD_PING_L
+        && !memcmp(&reply[sizeof NLMB_DevCtlSignature + 2], data, len))
+      return getTimeUSec() - sent;
+  }
+  return 0;
+}
+
+static inline void doPing(void)
+{
+  uint64_t min = ~(uint64_t) 0, max = 0, sum = 0;
+  int      got = 0;
+  int      err;
+
+  if ((err = snd_rawmidi_nonblock(inPort, 1)) < 0)
+  {
+    error("cannot set non-blocking mode: %s", snd_strerror(err));
+    return;
+  }
+  signal(SIGINT, sigHandler);
+  printf("Pinging the bridge on port: %s\n", pName);
+  for (int i = 0; i < pings && !stop; i++)
+  {
+    uint8_t const data[4] = { i & 0x7F, (i >> 7) & 0x7F, (i >> 14) & 0x7F, (i >> 21) & 0x7F };
+    uint64_t const sent   = getTimeUSec();
+    if (!sendDevCtl(CMD_PING_L, data, sizeof data))
+      return;
+    uint64_t const rtt = waitPong(data, sizeof data, sent);
+    if (rtt)
+    {
+      got++;
+      sum += rtt;
+      if (rtt < min)
+        min = rtt;
+      if (rtt > max)
+        max = rtt;
+    }
+    usleep(10000);
+  }
+  printf("%d of %d answered", got, pings);
+  if (got)
+    printf(", round trip %6.3lfms(min) %6.3lfms(avg) %6.3lfms(max)", min / 1000.0, sum / 1000.0 / got, max / 1000.0);
+  printf("\n");
+}
+
+// send a device control query and wait for the reply : the query plus 8-to-7 encoded values
+static int query(uint8_t const cmd, uint8_t const *const param, unsigned const nParam, uint8_t *const values, unsigned const size)
+{
+  unsigned const header = sizeof NLMB_DevCtlSignature + 2 + nParam;
+  uint8_t        reply[sizeof NLMB_DevCtlSignature + 2 + 16 + (2 * STATS_FIELDS * 4 * 8 + 6) / 7 + 2];
+  unsigned       pos = 0;
+
+  uint64_t const sent = getTimeUSec();
+  if (!sendDevCtl(cmd, param, nParam))
+    return 0;
+  while (getTimeUSec() - sent < PING_TIMEOUT_US)
+  {
+    uint8_t byte;
+    ssize_t read = snd_rawmidi_read(inPort, &byte, 1);
+    if (read == -EAGAIN)
+    {
+      usleep(10);
+      continue;
+    }
+    if (read != 1)
+      break;
+    if (byte == 0xF0)
+      pos = 0;
+    if (pos < sizeof reply)
+      reply[pos++] = byte;
+    if (byte != 0xF7 || pos <= header || reply[sizeof NLMB_DevCtlSignature] != cmd
+        || memcmp(&reply[sizeof NLMB_DevCtlSignature + 2], param, nParam))
+      continue;
+    unsigned n = 0;
+    for (unsigned i = header; i < pos - 1; i++)
+    {  // a byte with the top bits of the up to 7 bytes following it
+      if ((i - header) % 8 == 0)
+        continue;
+      if (n < size)
+        values[n++] = reply[i] | (((reply[header + (i - header) / 8 * 8] << ((i - header) % 8)) & 0x80));
+    }
+    if (n == size)
+      return 1;
+    break;
+  }
+  error("no reply from the bridge");
+  return 0;
+}
+
+static uint32_t getValue(uint8_t const *const b)
+{
+  return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t) b[3] << 24);
+}
+
+static inline BOOL setNonBlocking(void)
+{
+  int err;
+  if ((err = snd_rawmidi_nonblock(inPort, 1)) < 0)
+  {
+    error("cannot set non-blocking mode: %s", snd_strerror(err));
+    return FALSE;
+  }
+  return TRUE;
+}
+
+// ask for the counters and print them
+static inline void doStats(void)
+{
+  static char const *const names[STATS_FIELDS] = {
+    [STATS_PACKETS]          = "packets forwarded",
+    [STATS_BYTES]            = "bytes forwarded",
+    [STATS_URGENT_EVENTS]    = "urgent events forwarded",
+    [STATS_DROPPED]          = "packets dropped",
+    [STATS_DROPPED_INCOMING] = "dropped, port offline",
+    [STATS_LATE]             = "late packets",
+    [STATS_STALE]            = "stale packets",
+    [STATS_TIMEOUTS]         = "packet timeouts",
+    [STATS_MALFORMED]        = "malformed events",
+    [STATS_MAX_DWELL_US]     = "max. queue dwell [us]",
+    [STATS_MAX_URGENT_US]    = "max. urgent dwell [us]",
+    [STATS_USB_ERRORS]       = "USB errors, incoming port",
+    [STATS_SHAPER_HOLDS]     = "shaper holds, incoming port",
+    [STATS_SHAPER_HELD_US]   = "shaper held [us]",
+    [STATS_ARENA_PEAK]       = "max. arena use [bytes]",
+    [STATS_ARENA_FAILED]     = "did not fit into the arena",
+    [STATS_ARENA_TOTAL_PEAK] = "max. arena use, both",
+    [STATS_RECOVERY_LAST_US] = "last USB recovery [us]",
+    [STATS_RECOVERY_MAX_US]  = "max. USB recovery [us]",
+  };
+  uint8_t const none = 0;
+  uint8_t       values[2 * STATS_FIELDS * 4];
+
+  if (!setNonBlocking() || !query(CMD_STATS_L, &none, 0, values, sizeof values))
+    return;
+  printf("Counters of the bridge, read on port %s\n", pName);
+  printf("%-28s%14s%14s\n", "", "from HS port", "from FS port");
+  for (int i = 0; i < STATS_FIELDS; i++)
+    printf("%-28s%14u%14u\n", names[i], getValue(&values[i * 4]), getValue(&values[(STATS_FIELDS + i) * 4]));
+}
+
+// upper end of a histogram bucket in msecs
+static double bucketEnd(int const b)
+{
+  return (b == 0) ? 0.0 : ((1u << b) - 1) * 0.125;
+}
+
+// ask for the latency histograms and print them, with the buckets the percentiles fall into
+static inline void doHistogram(void)
+{
+  static char const *const phases[2] = { "wait", "wire" };
+  uint32_t                 h[2][2][HIST_BUCKETS];
+
+  if (!setNonBlocking())
+    return;
+  for (int p = 0; p < 2; p++)
+    for (int ph = 0; ph < 2; ph++)
+    {
+      uint8_t const param[3] = { p, ph, hist };
+      uint8_t       values[HIST_BUCKETS * 4];
+      if (!query(CMD_HISTOGRAM_L, param, sizeof param, values, sizeof values))
+        return;
+      for (int b = 0; b < HIST_BUCKETS; b++)
+        h[p][ph][b] = getValue(&values[b * 4]);
+    }
+  printf("Latency histograms of the bridge, read on port %s%s\n", pName, hist ? ", reset" : "");
+  printf("%-16s%12s%12s%12s%12s\n", "up to [ms]", "HS wait", "HS wire", "FS wait", "FS wire");
+  for (int b = 0; b < HIST_BUCKETS; b++)
+  {
+    if (b < HIST_BUCKETS - 1)
+      printf("%-16.3f", bucketEnd(b));
+    else
+      printf("%-16s", "longer");
+    printf("%12u%12u%12u%12u\n", h[0][0][b], h[0][1][b], h[1][0][b], h[1][1][b]);
+  }
+  for (int p = 0; p < 2; p++)
+    for (int ph = 0; ph < 2; ph++)
+    {
+      uint64_t total = 0, sum = 0;
+      for (int b = 0; b < HIST_BUCKETS; b++)
+        total += h[p][ph][b];
+      printf("from %s port, %s : %" PRIu64 " samples", p ? "FS" : "HS", phases[ph], total);
+      int const pct[3] = { 50, 99, 999 };
+      for (int i = 0, b = 0; total && i < 3; i++)
+      {
+        for (; b < HIST_BUCKETS - 1 && (sum + h[p][ph][b]) * 1000 < total * (pct[i] < 100 ? pct[i] * 10 : pct[i]); b++)
+          sum += h[p][ph][b];
+        if (b < HIST_BUCKETS - 1)
+          printf(", p%s <= %.3fms", (i == 2) ? "99.9" : (i ? "99" : "50"), bucketEnd(b));
+        else
+          printf(", p%s longer", (i == 2) ? "99.9" : (i ? "99" : "50"));
+      }
+      printf("\n");
+    }
+}
+
 //
 // ------------------------------------------
 //
@@ -696,7 +1139,19 @@ int main(int argc, char const *const argv[])
   getCmdLineParams(argc, argv);
   openPort();
   srand(time(0));
-  if (send)
+  if (ping)
+    doPing();
+  else if (stats)
+    doStats();
+  else if (hist >= 0)
+    doHistogram();
+  else if (echo >= 0)
+    doEcho();
+  else if (generate)
+    doGenerate();
+  else if (shapeRate >= 0)
+    doShape();
+  else if (send)
     doSend();
   else
     doReceive();
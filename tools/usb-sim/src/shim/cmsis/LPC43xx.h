@@ -0,0 +1,16 @@
+// host shim : the device header, with the peripherals the firmware under test uses relocated into the model
+#pragma once
+
+#include <stdint.h>
+#include_next "cmsis/LPC43xx.h"
+
+#include "sim_hw.h"
+
+#undef LPC_USB0_BASE
+#undef LPC_USB1_BASE
+#undef LPC_CREG_BASE
+#undef LPC_SCU_BASE
+#define LPC_USB0_BASE ((uintptr_t) &simUsbRegs[0])
+#define LPC_USB1_BASE ((uintptr_t) &simUsbRegs[1])
+#define LPC_CREG_BASE ((uintptr_t) &simCreg)
+#define LPC_SCU_BASE  ((uintptr_t) &simScu)
@@ -0,0 +1,39 @@
+// host shim : replaces the Cortex-M4 core header, the NVIC is part of the model
+#pragma once
+
+#include <stdint.h>
+
+#define __I  volatile  // writable so the model can drive status registers
+#define __O  volatile
+#define __IO volatile
+
+#define __STATIC_INLINE static inline
+
+void NVIC_EnableIRQ(int IRQn);
+void NVIC_DisableIRQ(int IRQn);
+void NVIC_SetPendingIRQ(int IRQn);
+void NVIC_ClearPendingIRQ(int IRQn);
+static inline void NVIC_SetPriority(int IRQn, uint32_t priority) { (void) IRQn; (void) priority; }  // all handlers run one at a time here
+
+#include "cmsis/core_cmFunc.h"
+#include "cmsis/core_cmInstr.h"
+
+// SysTick and SCB : the counter stands still, so times have ticker resolution here
+typedef struct
+{
+  __IO uint32_t CTRL;
+  __IO uint32_t LOAD;
+  __IO uint32_t VAL;
+  __I uint32_t  CALIB;
+} SysTick_Type;
+
+typedef struct
+{
+  __IO uint32_t ICSR;
+} SCB_Type;
+
+extern SysTick_Type simSysTick;
+extern SCB_Type     simSCB;
+#define SysTick                (&simSysTick)
+#define SCB                    (&simSCB)
+#define SCB_ICSR_PENDSTSET_Msk (1UL << 26)
@@ -0,0 +1,2 @@
+// host shim : no SIMD intrinsics are used by the firmware under test
+#pragma once
@@ -0,0 +1,9 @@
+// host shim : core register access, PRIMASK is part of the model
+#pragma once
+
+#include <stdint.h>
+
+void     __disable_irq(void);
+void     __enable_irq(void);
+uint32_t __get_PRIMASK(void);
+void     __set_PRIMASK(uint32_t priMask);
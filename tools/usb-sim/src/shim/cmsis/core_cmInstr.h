@@ -0,0 +1,13 @@
+// host shim : core instruction intrinsics, the exclusive monitor is part of the model
+#pragma once
+
+#include <stdint.h>
+
+static inline void __NOP(void) {}
+static inline void __DSB(void) { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+static inline void __DMB(void) { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+static inline void __ISB(void) { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+
+uint32_t __LDREXW(volatile uint32_t *addr);
+uint32_t __STREXW(uint32_t value, volatile uint32_t *addr);
+void     __CLREX(void);
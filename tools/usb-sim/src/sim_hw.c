@@ -0,0 +1,851 @@
+// Register-level model of the LPC43xx USB device controllers, see sim_hw.h.
+// Only what the firmware's driver uses is modelled : bulk and control endpoints with dTD lists, priming,
+// flushing, completions with IOC, NAK status, bus reset and port change. No isochronous or interrupt endpoints,
+// no transaction errors. Needs Linux on x86-64, for the single-stepping of trapped register stores.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "cmsis/LPC43xx.h"
+#include "usb/nl_usb_core.h"
+#include "sim_hw.h"
+
+SimRegPage_t  simRegPage;
+LPC_CREG_Type simCreg;
+LPC_SCU_Type  simScu;
+
+SimPortStats_t simStats[SIM_PORTS];
+
+void USB0_IRQHandler(void);
+void USB1_IRQHandler(void);
+
+// ---- core emulation : interrupt controller, exclusive monitor and a SysTick counter standing at the period start
+
+SysTick_Type simSysTick = { .LOAD = 1499, .VAL = 1499 };
+SCB_Type     simSCB;
+
+static int               irqEnabled[64];
+static int               irqPending[64];
+static volatile uint32_t primask;
+static volatile uint32_t *exclusiveAddr;
+
+void NVIC_EnableIRQ(int IRQn)
+{
+  irqEnabled[IRQn] = 1;
+}
+
+void NVIC_DisableIRQ(int IRQn)
+{
+  irqEnabled[IRQn] = 0;
+}
+
+void NVIC_SetPendingIRQ(int IRQn)
+{
+  irqPending[IRQn] = 1;
+}
+
+void NVIC_ClearPendingIRQ(int IRQn)
+{
+  irqPending[IRQn] = 0;
+}
+
+void __disable_irq(void)
+{
+  primask = 1;
+}
+
+void __enable_irq(void)
+{
+  primask = 0;
+}
+
+uint32_t __get_PRIMASK(void)
+{
+  return primask;
+}
+
+void __set_PRIMASK(uint32_t priMask)
+{
+  primask = priMask;
+}
+
+uint32_t __LDREXW(volatile uint32_t *addr)
+{
+  exclusiveAddr = addr;
+  return *addr;
+}
+
+uint32_t __STREXW(uint32_t value, volatile uint32_t *addr)
+{
+  if (exclusiveAddr != addr)
+    return 1;
+  *addr         = value;
+  exclusiveAddr = NULL;
+  return 0;
+}
+
+void __CLREX(void)
+{
+  exclusiveAddr = NULL;
+}
+
+// ---- device controller model
+
+#define BIT_OF(i)   (((i) &1) ? (1u << (16 + ((i) >> 1))) : (1u << ((i) >> 1)))
+#define TOKEN_ACTIVE (0x80u)
+
+typedef struct
+{
+  uint32_t pos;  // bytes moved within current dTD
+} EpModel_t;
+
+typedef struct
+{
+  int       attached;
+  int       highSpeed;
+  EpModel_t ep[EP_NUM_MAX];
+  // host OUT queue
+  uint8_t * outData;
+  uint32_t  outLen;
+  uint32_t  outCap;
+  uint32_t  outXferLeft;  // bytes left in the current host transfer (URB)
+  uint32_t  xferSize;
+  uint32_t  outBudget;
+  uint32_t  inBudget;
+  int       inPolling;
+  uint8_t   fastOut[4096];
+  uint32_t  fastOutLen;
+} PortModel_t;
+
+static PortModel_t       model[SIM_PORTS];
+static SimHostRxCallback rxCallback;
+static SimHostRxCallback fastRxCallback;
+
+static inline void atomicClear(volatile uint32_t *reg, uint32_t bits)
+{
+  __atomic_fetch_and((uint32_t *) reg, ~bits, __ATOMIC_SEQ_CST);
+}
+
+static inline void atomicSet(volatile uint32_t *reg, uint32_t bits)
+{
+  __atomic_fetch_or((uint32_t *) reg, bits, __ATOMIC_SEQ_CST);
+}
+
+static inline DQH_T *qhOf(uint8_t port, unsigned i)
+{
+  return ((DQH_T *) (uintptr_t) simUsbRegs[port].ENDPOINTLISTADDR) + i;
+}
+
+static inline DTD_T *tdOf(uint32_t addr)
+{
+  return (DTD_T *) (uintptr_t) (addr & ~0x1Fu);
+}
+
+static inline uint32_t maxPacket(uint8_t port, unsigned i)
+{
+  return (qhOf(port, i)->cap >> 16) & 0x7FF;
+}
+
+static void fetch(uint8_t port, unsigned i)
+{
+  DQH_T *qh = qhOf(port, i);
+  DTD_T *td = tdOf(qh->next_dTD);
+
+  qh->curr_dTD          = qh->next_dTD;
+  qh->total_bytes       = td->total_bytes;
+  qh->buffer0           = td->buffer0;
+  qh->buffer1           = td->buffer1;
+  qh->buffer2           = td->buffer2;
+  qh->buffer3           = td->buffer3;
+  qh->buffer4           = td->buffer4;
+  qh->next_dTD          = td->next_dTD;
+  model[port].ep[i].pos = 0;
+}
+
+static int isActive(uint8_t port, unsigned i)
+{
+  return (simUsbRegs[port].ENDPTSTAT & BIT_OF(i)) && (qhOf(port, i)->total_bytes & TOKEN_ACTIVE);
+}
+
+static void prime(uint8_t port, unsigned i)
+{
+  DQH_T *qh = qhOf(port, i);
+  if (simUsbRegs[port].ENDPTSTAT & BIT_OF(i))
+    return;
+  if (qh->next_dTD & 1)
+    return;
+  if (!(tdOf(qh->next_dTD)->total_bytes & TOKEN_ACTIVE))
+    return;
+  fetch(port, i);
+  atomicSet(&simUsbRegs[port].ENDPTSTAT, BIT_OF(i));
+}
+
+static void serviceRegs(uint8_t port)
+{
+  LPC_USB0_Type *r = &simUsbRegs[port];
+
+  if (r->USBCMD_D & USBCMD_RST)
+  {
+    r->ENDPTSTAT      = 0;
+    r->ENDPTCOMPLETE  = 0;
+    r->ENDPTSETUPSTAT = 0;
+    r->ENDPTNAK       = 0;
+    r->USBSTS_D       = 0;
+    atomicClear(&r->USBCMD_D, USBCMD_RST | USBCMD_RS);
+  }
+
+  uint32_t f = r->ENDPTFLUSH;
+  if (f)
+  {
+    atomicClear(&r->ENDPTSTAT, f);
+    atomicClear(&r->ENDPTFLUSH, f);
+  }
+
+  uint32_t p = r->ENDPTPRIME;
+  if (p)
+  {
+    if (r->ENDPOINTLISTADDR)
+      for (unsigned i = 0; i < EP_NUM_MAX; i++)
+        if (p & BIT_OF(i))
+          prime(port, i);
+    atomicClear(&r->ENDPTPRIME, p);
+  }
+}
+
+static void retire(uint8_t port, unsigned i)
+{
+  LPC_USB0_Type *r  = &simUsbRegs[port];
+  DQH_T *        qh = qhOf(port, i);
+  DTD_T *        td = tdOf(qh->curr_dTD);
+
+  qh->total_bytes &= ~TOKEN_ACTIVE;
+  td->total_bytes = qh->total_bytes;
+  if (td->total_bytes & TD_IOC)
+  {
+    atomicSet(&r->ENDPTCOMPLETE, BIT_OF(i));
+    atomicSet(&r->USBSTS_D, USBSTS_UI);
+  }
+  simStats[port].completions++;
+
+  uint32_t next = td->next_dTD;
+  qh->next_dTD  = next;
+  if (!(next & 1) && (tdOf(next)->total_bytes & TOKEN_ACTIVE))
+    fetch(port, i);
+  else
+    atomicClear(&r->ENDPTSTAT, BIT_OF(i));
+}
+
+static uint8_t *bufferAt(uint8_t port, unsigned i)
+{
+  DQH_T *  qh    = qhOf(port, i);
+  uint32_t start = qh->buffer0;
+  uint32_t off   = (start & 0xFFF) + model[port].ep[i].pos;
+  uint32_t page  = off >> 12;
+  uint32_t base;
+
+  switch (page)
+  {
+    case 0:
+      return (uint8_t *) (uintptr_t) (start + model[port].ep[i].pos);
+    case 1:
+      base = qh->buffer1;
+      break;
+    case 2:
+      base = qh->buffer2;
+      break;
+    case 3:
+      base = qh->buffer3;
+      break;
+    default:
+      base = qh->buffer4;
+      break;
+  }
+  return (uint8_t *) (uintptr_t) ((base & ~0xFFFu) + (off & 0xFFF));
+}
+
+static void moveBytes(uint8_t port, unsigned i, uint8_t *host, uint32_t n, int toDevice)
+{
+  // byte-wise so that page crossings are handled
+  for (uint32_t k = 0; k < n; k++)
+  {
+    uint8_t *dev = bufferAt(port, i);
+    if (toDevice)
+      *dev = host[k];
+    else
+      host[k] = *dev;
+    model[port].ep[i].pos++;
+  }
+}
+
+static void nak(uint8_t port, unsigned i)
+{
+  LPC_USB0_Type *r = &simUsbRegs[port];
+  atomicSet(&r->ENDPTNAK, BIT_OF(i));
+  if (r->ENDPTNAKEN & BIT_OF(i))
+    atomicSet(&r->USBSTS_D, USBSTS_NAKI);
+}
+
+// host sends one data packet to an OUT endpoint, returns bytes accepted or -1 on NAK
+static int hostOutPacket(uint8_t port, unsigned i, uint8_t *data, uint32_t len)
+{
+  DQH_T *qh = qhOf(port, i);
+  if (!isActive(port, i))
+  {
+    nak(port, i);
+    simStats[port].outNaks++;
+    return -1;
+  }
+  uint32_t left = (qh->total_bytes >> 16) & 0x7FFF;
+  if (len > left)
+  {
+    fprintf(stderr, "SIM: port %d ep %d: babble, packet %u > dTD space %u\n", port, i, len, left);
+    abort();
+  }
+  moveBytes(port, i, data, len, 1);
+  left -= len;
+  qh->total_bytes = (qh->total_bytes & 0x8000FFFFu) | (left << 16);
+  simStats[port].outPackets++;
+  if (len < maxPacket(port, i) || left == 0)
+    retire(port, i);
+  return len;
+}
+
+// host polls an IN endpoint, returns bytes received or -1 on NAK
+static int hostInPacket(uint8_t port, unsigned i, uint8_t *data)
+{
+  DQH_T *qh = qhOf(port, i);
+  if (!isActive(port, i))
+  {
+    nak(port, i);
+    simStats[port].inNaks++;
+    return -1;
+  }
+  uint32_t left = (qh->total_bytes >> 16) & 0x7FFF;
+  uint32_t mp   = maxPacket(port, i);
+  uint32_t n    = left < mp ? left : mp;
+  moveBytes(port, i, data, n, 0);
+  left -= n;
+  qh->total_bytes = (qh->total_bytes & 0x8000FFFFu) | (left << 16);
+  simStats[port].inPackets++;
+  if (n < mp || left == 0)
+    retire(port, i);
+  return n;
+}
+
+// ---- interrupt delivery
+
+static int handlerLevel;  // SysTick or USB handler running : the others are held pending, like on one NVIC priority
+
+static void stepped(void (*code)(void), void (*at)(void), int irq);
+static void busInHandler(void);
+
+static struct
+{
+  uint32_t rng;  // 0 --> no interleaving
+  void (*sysTick)(void);
+  int busDue[SIM_PORTS];  // the port's microframe of bus traffic has not happened yet
+} interleave;
+
+static uint32_t nextRandom(void)
+{
+  interleave.rng ^= interleave.rng << 13;
+  interleave.rng ^= interleave.rng >> 17;
+  interleave.rng ^= interleave.rng << 5;
+  return interleave.rng;
+}
+
+static void runHandler(void (*handler)(void))
+{
+  handlerLevel++;
+  exclusiveAddr = NULL;  // exception entry clears the local monitor
+  SIM_FwEnter();
+  if (interleave.rng)
+    stepped(handler, busInHandler, 0);
+  else
+    handler();
+  SIM_FwLeave();
+  exclusiveAddr = NULL;
+  handlerLevel--;
+}
+
+// runs the USB handlers whose interrupt is pending, enabled and not masked, returns how many ran
+static int serviceInterrupts(void)
+{
+  static int const irqs[SIM_PORTS] = { USB0_IRQn, USB1_IRQn };
+  uint8_t const    first           = interleave.rng ? nextRandom() & 1 : 0;
+  int              ran             = 0;
+
+  for (uint8_t k = 0; k < SIM_PORTS; k++)
+  {
+    uint8_t const port = k ^ first;
+    serviceRegs(port);
+    LPC_USB0_Type *r       = &simUsbRegs[port];
+    int            pending = irqPending[irqs[port]] || (r->USBSTS_D & r->USBINTR_D);
+    if (pending && irqEnabled[irqs[port]] && !primask && !handlerLevel)
+    {
+      irqPending[irqs[port]] = 0;
+      simStats[port].irqs++;
+      runHandler((port == 0) ? USB0_IRQHandler : USB1_IRQHandler);
+      serviceRegs(port);
+      ran++;
+    }
+  }
+  return ran;
+}
+
+void SIM_ServiceInterrupts(void)
+{
+  serviceInterrupts();
+}
+
+// ---- register write trapping : gives the firmware's stores hardware semantics (W1C, triggers)
+// While firmware code runs, the register page is read-only. A store faults, the page is opened up, the store is
+// single-stepped with the trap flag, and the written value is then applied like the controller would.
+
+static volatile int fwInside;
+static uint32_t     regSnapshot[4096 / 4];
+static uintptr_t    trapAddr;  // 0 --> no store being stepped
+
+static void protectRegs(int on)
+{
+  mprotect(&simRegPage, sizeof simRegPage, on ? PROT_READ : PROT_READ | PROT_WRITE);
+}
+
+static void applyWrite(uintptr_t addr)
+{
+  uintptr_t off  = addr - (uintptr_t) &simRegPage;
+  uint32_t  word = off / 4;
+  uint8_t   port = off / sizeof(LPC_USB0_Type);
+  if (port >= SIM_PORTS)
+    return;
+  LPC_USB0_Type *r     = &simUsbRegs[port];
+  uint32_t *     reg   = &((uint32_t *) &simRegPage)[word];
+  uint32_t       old   = regSnapshot[word];
+  uint32_t       value = *reg;
+  if (reg == &r->USBSTS_D || reg == &r->ENDPTCOMPLETE || reg == &r->ENDPTSETUPSTAT || reg == &r->ENDPTNAK)
+    *reg = old & ~value;
+  serviceRegs(port);
+}
+
+static void onSegv(int sig, siginfo_t *si, void *ctx)
+{
+  uintptr_t a = (uintptr_t) si->si_addr;
+  if (a < (uintptr_t) &simRegPage || a >= (uintptr_t) &simRegPage + sizeof simRegPage)
+  {
+    signal(SIGSEGV, SIG_DFL);
+    return;
+  }
+  (void) sig;
+  memcpy(regSnapshot, &simRegPage, sizeof regSnapshot);
+  trapAddr = a & ~3u;
+  protectRegs(0);
+  ((ucontext_t *) ctx)->uc_mcontext.gregs[REG_EFL] |= 0x100;  // single step the store
+}
+
+// ---- preemption : firmware code is single-stepped up to an instruction picked at random, where other code runs.
+// Stores into the register page are stepped the same way, both share the trap handler.
+
+typedef struct
+{
+  void (*at)(void);  // runs at the point
+  uint32_t point;    // instructions until then
+  uint32_t count;    // instructions stepped
+  int      irq;      // an interrupt : held off while PRIMASK is set
+  int      active;
+} Step_t;
+
+static Step_t *volatile step;  // innermost code being stepped
+
+static struct
+{
+  void (*code)(void);
+  uint32_t longest;  // instructions of its longest run to the end ...
+  uint32_t range;    // ... and the range the point is picked from, grows while points beyond that one are reached
+} lengths[8];
+
+// the code preempted is left as it is, the one preempting it gets the register page as firmware code outside
+static void preempt(void (*at)(void))
+{
+  int const inside = fwInside;
+  fwInside         = 0;
+  protectRegs(0);
+  at();
+  fwInside = inside;
+  protectRegs(inside > 0);
+}
+
+static void onTrap(int sig, siginfo_t *si, void *ctx)
+{
+  greg_t *const efl = &((ucontext_t *) ctx)->uc_mcontext.gregs[REG_EFL];
+  Step_t *const s   = step;
+
+  (void) sig;
+  (void) si;
+  if (trapAddr)
+  {  // a trapped store was stepped
+    applyWrite(trapAddr);
+    trapAddr = 0;
+    protectRegs(1);
+  }
+  if (!s || !s->active)
+  {
+    *efl &= ~0x100;
+    return;
+  }
+  if (++s->count < s->point || (s->irq && primask))
+    return;  // keep stepping
+  *efl &= ~0x100;
+  s->active = 0;
+  preempt(s->at);
+}
+
+static void onStep(int sig, siginfo_t *si, void *ctx)
+{
+  (void) sig;
+  (void) si;
+  ((ucontext_t *) ctx)->uc_mcontext.gregs[REG_EFL] |= 0x100;  // single step from the return on
+}
+
+// runs code, and at a random instruction of it, or after it when it ends before, the code preempting it
+static void stepped(void (*code)(void), void (*at)(void), int irq)
+{
+  Step_t *const outer = step;
+  unsigned      i     = 0;
+
+  while (i < sizeof lengths / sizeof lengths[0] - 1 && lengths[i].code && lengths[i].code != code)
+    i++;
+  if (lengths[i].code != code)
+  {
+    lengths[i].code  = code;
+    lengths[i].range = 64;
+  }
+
+  Step_t s = { .at = at, .point = 1 + nextRandom() % lengths[i].range, .irq = irq, .active = 1 };
+  step     = &s;
+  raise(SIGUSR1);
+  code();
+  if (s.active)
+  {
+    s.active = 0;  // the next trap ends the stepping
+    if (s.count > lengths[i].longest)
+      lengths[i].longest = s.count;
+    lengths[i].range = lengths[i].longest + 64;
+    preempt(at);
+  }
+  else if (s.point > lengths[i].longest && 2 * s.point > lengths[i].range)
+    lengths[i].range = 2 * s.point;
+  step = outer;
+}
+
+void SIM_FwEnter(void)
+{
+  if (fwInside++ == 0)
+    protectRegs(1);
+}
+
+void SIM_FwLeave(void)
+{
+  if (--fwInside == 0)
+    protectRegs(0);
+}
+
+// ---- host bus activity
+
+void SIM_Init(void)
+{
+  struct sigaction sa;
+  memset(&sa, 0, sizeof sa);
+  sa.sa_flags     = SA_SIGINFO | SA_NODEFER;
+  sa.sa_sigaction = onSegv;
+  sigaction(SIGSEGV, &sa, NULL);
+  sa.sa_sigaction = onTrap;
+  sigaction(SIGTRAP, &sa, NULL);
+  sa.sa_sigaction = onStep;
+  sigaction(SIGUSR1, &sa, NULL);
+  memset(model, 0, sizeof model);
+  for (uint8_t port = 0; port < SIM_PORTS; port++)
+  {
+    model[port].xferSize  = 512;
+    model[port].outBudget = 1;
+    model[port].inBudget  = 1;
+    model[port].inPolling = 1;
+  }
+}
+
+void SIM_HostSetRxCallback(SimHostRxCallback cb)
+{
+  rxCallback = cb;
+}
+
+void SIM_HostSetFastRxCallback(SimHostRxCallback cb)
+{
+  fastRxCallback = cb;
+}
+
+uint32_t SIM_HostQueueFastOut(uint8_t port, uint8_t const *data, uint32_t len)
+{
+  PortModel_t *m = &model[port];
+  if (m->fastOutLen + len > sizeof m->fastOut)
+    return 0;
+  memcpy(m->fastOut + m->fastOutLen, data, len);
+  m->fastOutLen += len;
+  return len;
+}
+
+void SIM_HostSetTransferSize(uint8_t port, uint32_t bytes)
+{
+  model[port].xferSize = bytes;
+}
+
+void SIM_HostSetPacketBudget(uint8_t port, uint32_t outPerTick, uint32_t inPerTick)
+{
+  model[port].outBudget = outPerTick;
+  model[port].inBudget  = inPerTick;
+}
+
+void SIM_HostSetInPolling(uint8_t port, int enable)
+{
+  model[port].inPolling = enable;
+}
+
+uint32_t SIM_HostQueueOut(uint8_t port, uint8_t const *data, uint32_t len)
+{
+  PortModel_t *m = &model[port];
+  if (m->outLen + len > m->outCap)
+  {
+    m->outCap  = (m->outLen + len) * 2;
+    m->outData = realloc(m->outData, m->outCap);
+  }
+  memcpy(m->outData + m->outLen, data, len);
+  m->outLen += len;
+  return len;
+}
+
+uint32_t SIM_HostOutPending(uint8_t port)
+{
+  return model[port].outLen;
+}
+
+void SIM_Attach(uint8_t port, int highSpeed)
+{
+  model[port].attached  = 1;
+  model[port].highSpeed = highSpeed && (port == 0);
+  SIM_BusReset(port);
+}
+
+void SIM_Detach(uint8_t port)
+{
+  model[port].attached = 0;
+  simUsbRegs[port].PORTSC1_D &= ~((1 << 0) | (1 << 9));
+  atomicSet(&simUsbRegs[port].USBSTS_D, USBSTS_SLI);
+}
+
+void SIM_BusReset(uint8_t port)
+{
+  LPC_USB0_Type *r = &simUsbRegs[port];
+  r->ENDPTSTAT     = 0;
+  r->DEVICEADDR    = 0;
+  atomicSet(&r->USBSTS_D, USBSTS_URI);
+  SIM_ServiceInterrupts();
+  r->PORTSC1_D = (1 << 0) | (model[port].highSpeed ? (1 << 9) : 0);
+  atomicSet(&r->USBSTS_D, USBSTS_PCI);
+  SIM_ServiceInterrupts();
+}
+
+// EP1 OUT, the MIDI OUT endpoint : up to the packet budget per microframe, a short packet ends a transfer
+static void hostOut(uint8_t port)
+{
+  PortModel_t *m = &model[port];
+  for (uint32_t b = 0; b < m->outBudget && m->outLen; b++)
+  {
+    if (m->outXferLeft == 0)
+      m->outXferLeft = m->outLen < m->xferSize ? m->outLen : m->xferSize;
+    uint32_t mp = maxPacket(port, 2);
+    uint32_t n  = m->outXferLeft < mp ? m->outXferLeft : mp;
+    if (hostOutPacket(port, 2, m->outData, n) < 0)
+      break;
+    memmove(m->outData, m->outData + n, m->outLen - n);
+    m->outLen -= n;
+    m->outXferLeft -= n;
+    SIM_ServiceInterrupts();
+  }
+}
+
+// fast lane, EP2 OUT and EP1 IN : one packet each way per microframe, ahead of the main endpoints
+static void hostFast(uint8_t port)
+{
+  PortModel_t *m = &model[port];
+  uint8_t      buf[1024];
+  if (!maxPacket(port, 4))
+    return;  // not configured
+  if (m->fastOutLen)
+  {
+    uint32_t mp = maxPacket(port, 4);
+    uint32_t n  = m->fastOutLen < mp ? m->fastOutLen : mp;
+    if (hostOutPacket(port, 4, m->fastOut, n) >= 0)
+    {
+      memmove(m->fastOut, m->fastOut + n, m->fastOutLen - n);
+      m->fastOutLen -= n;
+    }
+    SIM_ServiceInterrupts();
+  }
+  if (!m->inPolling)
+    return;
+  int n = hostInPacket(port, 3, buf);
+  if (n > 0 && fastRxCallback)
+    fastRxCallback(port, buf, n);
+  SIM_ServiceInterrupts();
+}
+
+// EP2 IN, the MIDI IN endpoint
+static void hostIn(uint8_t port)
+{
+  PortModel_t *m = &model[port];
+  uint8_t      buf[1024];
+  if (!m->inPolling)
+    return;
+  for (uint32_t b = 0; b < m->inBudget; b++)
+  {
+    int n = hostInPacket(port, 5, buf);
+    if (n < 0)
+      break;
+    if (n && rxCallback)
+      rxCallback(port, buf, n);
+    SIM_ServiceInterrupts();
+  }
+}
+
+static void busPort(uint8_t port)
+{
+  if (!model[port].attached || !simUsbRegs[port].ENDPOINTLISTADDR)
+    return;
+  serviceRegs(port);
+  hostFast(port);
+  hostOut(port);
+  hostIn(port);
+}
+
+void SIM_BusTick(void)
+{
+  for (uint8_t port = 0; port < SIM_PORTS; port++)
+    busPort(port);
+  SIM_ServiceInterrupts();
+}
+
+// ---- interleaving
+
+void SIM_SetInterleave(uint32_t seed)
+{
+  interleave.rng = seed;
+}
+
+// the controller moves the microframe of traffic of a port while a handler runs
+static void busInHandler(void)
+{
+  uint8_t port = nextRandom() % SIM_PORTS;
+  if (!interleave.busDue[port])
+    port ^= 1;
+  if (!interleave.busDue[port])
+    return;
+  interleave.busDue[port] = 0;
+  busPort(port);
+}
+
+// the SysTick and USB interrupts come in while the main loop runs
+static void interruptMain(void)
+{
+  if (nextRandom() & 1)
+    serviceInterrupts();  // USB before SysTick
+  runHandler(interleave.sysTick);
+  for (uint8_t port = 0; port < SIM_PORTS; port++)
+    if (interleave.busDue[port])
+    {  // did not happen during a handler
+      interleave.busDue[port] = 0;
+      busPort(port);
+    }
+  for (int i = 0; i < 8 && serviceInterrupts(); i++)
+    ;  // tail-chained, the handlers can leave interrupts pending behind them
+}
+
+void SIM_InterleavedTick(void (*sysTick)(void), void (*mainLoop)(void))
+{
+  interleave.sysTick = sysTick;
+  for (uint8_t port = 0; port < SIM_PORTS; port++)
+    interleave.busDue[port] = 1;
+  SIM_FwEnter();
+  stepped(mainLoop, interruptMain, 1);
+  SIM_FwLeave();
+}
+
+// ---- control transfers for enumeration
+
+static int control(uint8_t port, uint8_t reqType, uint8_t req, uint16_t value, uint16_t index, uint16_t length, uint8_t *data)
+{
+  LPC_USB0_Type *r  = &simUsbRegs[port];
+  DQH_T *        qh = qhOf(port, 0);
+
+  r->ENDPTSTAT &= ~0x00010001u;  // setup aborts any pending control transfer
+  qh->setup[0] = reqType | (req << 8) | (value << 16);
+  qh->setup[1] = index | (length << 16);
+  atomicSet(&r->ENDPTSETUPSTAT, 1);
+  atomicSet(&r->USBSTS_D, USBSTS_UI);
+  SIM_ServiceInterrupts();
+
+  int received = 0;
+  if (reqType & 0x80)
+  {  // data IN stage
+    for (int tries = 0; tries < 1000 && received < length; tries++)
+    {
+      uint8_t buf[64];
+      serviceRegs(port);
+      int n = hostInPacket(port, 1, buf);
+      SIM_ServiceInterrupts();
+      if (n < 0)
+        continue;
+      memcpy(data + received, buf, n);
+      received += n;
+      if (n < 64)
+        break;
+    }
+    // status OUT stage
+    for (int tries = 0; tries < 1000; tries++)
+    {
+      serviceRegs(port);
+      if (hostOutPacket(port, 0, NULL, 0) >= 0)
+        break;
+      SIM_ServiceInterrupts();
+    }
+    SIM_ServiceInterrupts();
+  }
+  else
+  {  // status IN stage
+    for (int tries = 0; tries < 1000; tries++)
+    {
+      uint8_t buf[64];
+      serviceRegs(port);
+      if (hostInPacket(port, 1, buf) >= 0)
+        break;
+      SIM_ServiceInterrupts();
+    }
+    SIM_ServiceInterrupts();
+  }
+  return received;
+}
+
+int SIM_Enumerate(uint8_t port)
+{
+  uint8_t desc[512];
+  if (control(port, 0x80, 6, 0x0100, 0, 18, desc) != 18)
+    return 0;
+  control(port, 0x00, 5, 1 + port, 0, 0, NULL);
+  int len = control(port, 0x80, 6, 0x0200, 0, 255, desc);
+  if (len < 9)
+    return 0;
+  control(port, 0x00, 9, 1, 0, 0, NULL);
+  return 1;
+}
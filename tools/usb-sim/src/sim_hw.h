@@ -0,0 +1,69 @@
+// Register-level model of the two LPC43xx USB device controllers, plus the hosts attached to them.
+// The firmware's USB driver runs unchanged on it : the controller registers live in a page of host memory,
+// and the dQH/dTD lists the driver sets up are walked like the controller's DMA would do. Write-1-to-clear
+// status registers and ENDPTPRIME/ENDPTFLUSH get their hardware semantics by trapping the firmware's stores
+// into that page, see sim_hw.c. One call of SIM_BusTick() is one 125us microframe of bus traffic.
+#pragma once
+
+#include <stdint.h>
+
+#define SIM_PORTS (2)
+
+// the pointers the firmware stores into dQHs and registers are 32 bits wide, so this is linked non-PIE
+typedef union
+{
+  LPC_USB0_Type r[SIM_PORTS];
+  uint8_t       page[4096];
+} __attribute__((aligned(4096))) SimRegPage_t;
+
+extern SimRegPage_t  simRegPage;
+extern LPC_CREG_Type simCreg;
+extern LPC_SCU_Type  simScu;
+#define simUsbRegs (simRegPage.r)
+
+// ---- bus and host side
+typedef void (*SimHostRxCallback)(uint8_t port, uint8_t const *data, uint32_t len);
+
+void SIM_Init(void);
+void SIM_Attach(uint8_t port, int highSpeed);
+void SIM_Detach(uint8_t port);
+void SIM_BusReset(uint8_t port);
+int  SIM_Enumerate(uint8_t port);  // standard requests up to SET_CONFIGURATION, 0 --> failed
+
+void SIM_HostSetRxCallback(SimHostRxCallback cb);                                 // data read from the MIDI IN endpoint
+void SIM_HostSetTransferSize(uint8_t port, uint32_t bytes);                        // of the host's OUT transfers (URBs)
+void SIM_HostSetPacketBudget(uint8_t port, uint32_t outPerTick, uint32_t inPerTick);  // bulk packets per microframe
+void SIM_HostSetInPolling(uint8_t port, int enable);                               // 0 --> the host stalls, IN tokens stop
+
+uint32_t SIM_HostQueueOut(uint8_t port, uint8_t const *data, uint32_t len);  // USB-MIDI event packets to send
+uint32_t SIM_HostOutPending(uint8_t port);
+
+// fast lane endpoints 0x02 / 0x81, when the firmware offers them (FAST_LANE_ENDPOINTS)
+void     SIM_HostSetFastRxCallback(SimHostRxCallback cb);
+uint32_t SIM_HostQueueFastOut(uint8_t port, uint8_t const *data, uint32_t len);
+
+void SIM_BusTick(void);
+void SIM_ServiceInterrupts(void);
+
+// firmware code must be run in between these, so its register stores are trapped
+void SIM_FwEnter(void);
+void SIM_FwLeave(void);
+
+// ---- interleaving : one 125us period with the main loop preempted by the SysTick and USB handlers, and those by
+// the controller moving the microframe of bus traffic, each at an instruction picked at random. Firmware code is
+// single-stepped up to there. A seed other than 0 also turns it on for the interrupts during enumeration.
+void SIM_SetInterleave(uint32_t seed);
+void SIM_InterleavedTick(void (*sysTick)(void), void (*mainLoop)(void));
+
+// ---- statistics
+typedef struct
+{
+  uint64_t outPackets;
+  uint64_t outNaks;
+  uint64_t inPackets;
+  uint64_t inNaks;
+  uint64_t completions;
+  uint64_t irqs;
+} SimPortStats_t;
+
+extern SimPortStats_t simStats[SIM_PORTS];
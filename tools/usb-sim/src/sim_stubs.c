@@ -0,0 +1,36 @@
+// board-level stubs for the simulated build : LEDs, VBUS sense, error display and the unique ID
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "drv/error_display.h"
+#include "sys/flash.h"
+
+static uint32_t vbus[2] = { 1, 1 };
+static uint32_t dummyPins[8];
+
+volatile uint32_t* const LEDs[6]    = { &dummyPins[0], &dummyPins[1], &dummyPins[2], &dummyPins[3], &dummyPins[4], &dummyPins[5] };
+volatile uint32_t* const USBVBUS[2] = { &vbus[0], &vbus[1] };
+volatile uint32_t* const DEBUG[2]   = { &dummyPins[6], &dummyPins[7] };
+
+int showFirmwareVersion(void)
+{
+  return 0;
+}
+
+int iapGetUniqueId(iapUniqueId_t* pId)
+{
+  pId->data[0] = 0x12345678;
+  pId->data[1] = pId->data[2] = pId->data[3] = 0;
+  return 1;
+}
+
+void DisplayError(ErrorEvent_t const err)
+{
+  (void) err;
+}
+
+void DisplayErrorAndHalt(ErrorEvent_t const err)
+{
+  fprintf(stderr, "FIRMWARE HALT: error %d\n", err);
+  exit(2);
+}
@@ -0,0 +1,541 @@
+// Host benchmark of the complete relay path : the firmware's USB driver (nl_usb_core.c, nl_usb_midi.c), the relay
+// (MIDI_relay.c) and everything it uses, compiled for the host and run on a register-level model of the two
+// USB device controllers, see sim_hw.h. Both ports are enumerated by simulated hosts, then one host sends
+// numbered SysEx messages as bulk traffic, optionally with notes in between, a stalling receiver, a bus reset
+// or a controller error, and the other host checks what arrives. Time runs in 125us ticks of the firmware's
+// ticker, one microframe of bus traffic per tick, so the results are the same on every run and machine.
+// The exit code is 0 only when no complete message arrived corrupted or out of order, and no message was lost
+// without the bridge counting a drop, for use in CI : messages dropped or cut off by the bridge are reported, but
+// are what it does by design when a host stalls, resets or the controller fails. E.g. "usb-sim -p 1 -P 80" checks
+// that device control messages in between the traffic do not take any of it with them. With "-j seed" the main
+// loop, the SysTick and USB handlers and the controller preempt each other at random instructions instead of
+// taking turns, for the races between them.
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "cmsis/LPC43xx.h"
+#include "sys/ticker.h"
+#include "midi/MIDI_relay.h"
+#include "midi/MIDI_arena.h"
+#include "midi/MIDI_statemonitor.h"
+#include "midi/nl_devctl_defs.h"
+#include "usb/nl_usb_core.h"
+#include "usb/nl_usb_midi.h"
+#include "sim_hw.h"
+
+#define TICKS_PER_MS (8)
+#define MAX_SIZE     (65536)  // max. SysEx size
+#define SEQ_SLOTS    (65536)  // send times kept, by sequence number
+#define HIST_TICKS   (80000)  // latency histogram range, longer ones are counted in the last slot
+
+typedef struct
+{
+  uint32_t count;
+  uint64_t sum;
+  uint32_t max;
+  uint32_t hist[HIST_TICKS];
+} Latency_t;
+
+// SysEx being read by a host
+typedef struct
+{
+  uint8_t  buf[MAX_SIZE];
+  uint32_t pos;
+  int      inSysex;
+} SysexIn_t;
+
+static SysexIn_t sysexIn[SIM_PORTS];  // per port, the sending host gets the ping replies
+
+// what the receiving host sees
+static struct
+{
+  uint8_t   port;
+  uint32_t  expectSeq;
+  uint64_t  msgs;
+  uint64_t  bytes;
+  uint64_t  corrupted;  // wrong size or content
+  uint64_t  cut;        // SysEx without start or end, or the start of one spliced to the end of a later one
+  int       suspect;    // a message was wrong, a cut when it was short or the next good one shows data in between was dropped
+  uint32_t  suspectSeq;
+  uint32_t  suspectLen;
+  uint64_t  lost;       // sequence numbers skipped, data dropped by the bridge
+  uint64_t  firstTick, lastTick;
+  Latency_t sysex;
+  Latency_t notes;
+  uint32_t  noteSeq;      // next note expected ...
+  uint64_t  notesBehind;  // ... and notes arriving after a later one
+} rx;
+static uint32_t  interleaveSeed;
+
+static uint64_t  sysexSent[SEQ_SLOTS];
+static uint64_t  noteSent[SEQ_SLOTS];
+static uint64_t  fastSent[SEQ_SLOTS];
+static uint64_t  pingSent[SEQ_SLOTS];
+static uint32_t  msgSize = 1000;
+static uint32_t  pingSeq, fastSeq;
+static Latency_t pings, fast;
+
+static void usage(void)
+{
+  printf(
+      "Usage: usb-sim [options]\n"
+      "\n"
+      "-s size      : SysEx message size in bytes, default is 1000\n"
+      "-t seconds   : length of the run, default is 2\n"
+      "-p port      : sending port, 0 = HS, 1 = FS, default is 0\n"
+      "-r bytes/s   : rate of SysEx sent, default is 0 --> as fast as the bridge takes it\n"
+      "-j seed      : the main loop, handlers and controller preempt each other at random instructions, much slower\n"
+      "-x bytes     : size of the sending host's transfers, default is 512 on HS, 64 on FS\n"
+      "-b hs fs     : bulk packets per microframe each host moves per direction, default is 8 and 2\n"
+      "-n ticks     : a note-on every n ticks in between the SysEx, for the latency of short messages\n"
+      "-f ticks     : a note-on every n ticks on the fast lane endpoints, firmware built with FAST_LANE_ENDPOINTS\n"
+      "-P ticks     : a device control ping every n ticks on the sending port\n"
+      "-i ms len    : the receiving host stops polling at ms for len ms\n"
+      "-w on off    : the receiving host polls for on ms, then pauses for off ms, over and over\n"
+      "-R ms port   : the host resets the bus of the port at ms and enumerates it again\n"
+      "-e ms port   : controller error on the port at ms, the host enumerates it again 100ms after it reconnects\n"
+      "\n"
+      "The exit code is 1 when a message arrived corrupted, a note out of order, or a message was lost without the bridge counting a drop.\n"
+      "Latencies are from a message being queued in the sending host until it is read by the receiving host,\n"
+      "in steps of the 125us tick.\n");
+}
+
+static void addLatency(Latency_t *const l, uint64_t const ticks)
+{
+  uint32_t const t = (ticks < HIST_TICKS) ? ticks : HIST_TICKS - 1;
+  l->count++;
+  l->sum += ticks;
+  if (t > l->max)
+    l->max = t;
+  l->hist[t]++;
+}
+
+static double percentile(Latency_t const *const l, unsigned const permille)
+{
+  uint64_t sum = 0;
+  for (uint32_t t = 0; t < HIST_TICKS; t++)
+    if ((sum += l->hist[t]) * 1000 >= (uint64_t) l->count * permille)
+      return (double) t / TICKS_PER_MS;
+  return (double) HIST_TICKS / TICKS_PER_MS;
+}
+
+static void report(char const *const name, Latency_t const *const l)
+{
+  if (!l->count)
+    return;
+  printf("%-7s: %8u, latency avg %7.3fms, p50 %7.3fms, p99 %7.3fms, max %7.3fms\n", name, l->count,
+         (double) l->sum / l->count / TICKS_PER_MS, percentile(l, 500), percentile(l, 990), (double) l->max / TICKS_PER_MS);
+}
+
+// plain MIDI bytes into USB-MIDI event packets of cable 0
+static uint32_t toEvents(uint8_t const *const raw, uint32_t const len, uint8_t *const dest)
+{
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < len; i += 3)
+  {
+    uint32_t const left = len - i;
+    dest[n]             = (left > 3) ? 0x04 : 0x04 + left;  // SysEx starts or continues, ends with 1, 2 or 3 bytes
+    memset(&dest[n + 1], 0, 3);
+    memcpy(&dest[n + 1], &raw[i], (left > 3) ? 3 : left);
+    n += 4;
+  }
+  return n;
+}
+
+// F0 7D, the sequence number in 4 bytes, a pattern following from it, F7
+static uint32_t makeSysex(uint32_t const seq, uint8_t *const dest)
+{
+  static uint8_t raw[MAX_SIZE];
+  uint32_t       n = 0;
+
+  raw[n++] = 0xF0;
+  raw[n++] = 0x7D;
+  for (int i = 0; i < 4; i++)
+    raw[n++] = (seq >> (7 * i)) & 0x7F;
+  while (n < msgSize - 1)
+  {
+    raw[n] = (seq + n) & 0x7F;
+    n++;
+  }
+  raw[n++] = 0xF7;
+  return toEvents(raw, n, dest);
+}
+
+static uint32_t makeDevCtl(uint8_t const cmd, uint8_t const *const data, uint32_t const len, uint8_t *const dest)
+{
+  uint8_t  raw[sizeof NLMB_DevCtlSignature + 2 + 16 + 1];
+  uint32_t n = sizeof NLMB_DevCtlSignature;
+
+  memcpy(raw, NLMB_DevCtlSignature, n);
+  raw[n++] = cmd;
+  raw[n++] = 0x01;
+  memcpy(&raw[n], data, len);
+  n += len;
+  raw[n++] = 0xF7;
+  return toEvents(raw, n, dest);
+}
+
+static void checkSysex(uint8_t const port, uint8_t const *const b, uint32_t const n)
+{
+  if (n == sizeof NLMB_DevCtlSignature + 2 + 4 + 1 && !memcmp(b, NLMB_DevCtlSignature, sizeof NLMB_DevCtlSignature)
+      && b[sizeof NLMB_DevCtlSignature] == CMD_PING_L)
+  {  // ping reply, or a ping relayed as it was not at the start of a transfer
+    uint8_t const *const d   = &b[sizeof NLMB_DevCtlSignature + 2];
+    uint32_t const       seq = d[0] | (d[1] << 7) | (d[2] << 14) | (d[3] << 21);
+    if (port != rx.port)
+      addLatency(&pings, ticker - pingSent[seq % SEQ_SLOTS]);
+    return;
+  }
+  uint32_t const seq  = (n >= 8) ? b[2] | (b[3] << 7) | (b[4] << 14) | (b[5] << 21) : 0;
+  int const      head = (n >= 8 && b[1] == 0x7D);  // starts like one of ours, so its sequence number counts
+  int            ok   = (head && n == msgSize);
+  for (uint32_t i = 6; ok && i < n - 1; i++)
+    ok = (b[i] == ((seq + i) & 0x7F));
+  if (rx.suspect && head)
+  {  // a message spliced from two has at least the one after its start missing, or a part of its own
+    if (seq >= rx.suspectSeq + 2 || (seq == rx.suspectSeq + 1 && rx.suspectLen < msgSize))
+      rx.cut++;
+    else
+      rx.corrupted++;
+    rx.suspect = 0;
+  }
+  if (!ok)
+  {  // the next one tells, it may be another splice after further drops
+    rx.corrupted += rx.suspect;
+    rx.suspect    = 1;
+    rx.suspectSeq = seq;
+    rx.suspectLen = n;
+    return;
+  }
+  if (seq < rx.expectSeq)
+  {
+    rx.corrupted++;  // out of order or duplicated
+    return;
+  }
+  rx.lost += seq - rx.expectSeq;
+  rx.expectSeq = seq + 1;
+  rx.msgs++;
+  addLatency(&rx.sysex, ticker - sysexSent[seq % SEQ_SLOTS]);
+}
+
+static void onHostRx(uint8_t const port, uint8_t const *const data, uint32_t const len)
+{
+  SysexIn_t *const sx = &sysexIn[port];
+
+  if (port == rx.port)
+  {
+    if (!rx.firstTick)
+      rx.firstTick = ticker;
+    rx.lastTick = ticker;
+    rx.bytes += len;
+  }
+  for (uint32_t i = 0; i + 3 < len; i += 4)
+  {
+    uint8_t const *const p = &data[i];
+    int                  cnt;
+
+    switch (p[0] & 0x0F)
+    {
+      case 0x4:
+      case 0x7:
+        cnt = 3;
+        break;
+      case 0x6:
+        cnt = 2;
+        break;
+      case 0x5:
+        cnt = 1;
+        break;
+      case 0x9:
+      {
+        uint32_t const seq = p[2] | (p[3] << 7);
+        addLatency(&rx.notes, ticker - noteSent[seq % SEQ_SLOTS]);
+        if (((rx.noteSeq - seq - 1) & 0x3FFF) < 0x2000)
+          rx.notesBehind++;  // lost ones only leave a gap
+        else
+          rx.noteSeq = (seq + 1) & 0x3FFF;
+        continue;
+      }
+      default:
+        continue;
+    }
+    for (int k = 1; k <= cnt; k++)
+    {
+      if (p[k] == 0xF0)
+      {
+        rx.cut += sx->inSysex;
+        sx->inSysex = 1;
+        sx->pos     = 0;
+      }
+      if (sx->pos < sizeof sx->buf)
+        sx->buf[sx->pos++] = p[k];
+      if (p[k] == 0xF7)
+      {
+        if (sx->inSysex)
+          checkSysex(port, sx->buf, sx->pos);
+        else
+          rx.cut++;
+        sx->inSysex = 0;
+        sx->pos     = 0;
+      }
+    }
+  }
+}
+
+static void onHostFastRx(uint8_t const port, uint8_t const *const data, uint32_t const len)
+{
+  (void) port;
+  for (uint32_t i = 0; i + 3 < len; i += 4)
+    if ((data[i] & 0x0F) == 0x9)
+      addLatency(&fast, ticker - fastSent[(data[i + 2] | (data[i + 3] << 7)) % SEQ_SLOTS]);
+}
+
+static void sysTick(void)
+{
+  ticker++;
+  MIDI_Relay_Tick();
+}
+
+// one 125us period : bus traffic, then the SysTick handler and the main loop, like on the board
+static void runTick(void)
+{
+  if (interleaveSeed)
+  {
+    SIM_InterleavedTick(sysTick, SMON_Process);
+    return;
+  }
+  SIM_BusTick();
+  SIM_FwEnter();
+  sysTick();
+  SIM_FwLeave();
+  SIM_ServiceInterrupts();
+  SIM_FwEnter();
+  SMON_Process();
+  SIM_FwLeave();
+}
+
+static int enumerate(uint8_t const port)
+{
+  if (SIM_Enumerate(port))
+    return 1;
+  fprintf(stderr, "usb-sim: enumeration of port %u failed\n", port);
+  return 0;
+}
+
+int main(int const argc, char const *const argv[])
+{
+  double   seconds           = 2;
+  int      src               = 0;
+  double   rate              = 0;
+  uint32_t xfer              = 0;
+  uint32_t budget[SIM_PORTS] = { 8, 2 };
+  uint32_t noteEvery         = 0, fastEvery = 0, pingEvery = 0;
+  double   stallAt           = -1, stallLen = 0;
+  uint64_t pollOn            = 0, pollOff = 0;  // ticks
+  double   resetAt           = -1, errorAt = -1, enumerateAt = -1;
+  int      resetPort         = 0, errorPort = 0;
+
+  for (int i = 1; i < argc; i++)
+  {
+    char const *const o    = argv[i];
+    int const         left = argc - 1 - i;
+    if (!strcmp(o, "-s") && left >= 1)
+      msgSize = atoi(argv[++i]);
+    else if (!strcmp(o, "-t") && left >= 1)
+      seconds = atof(argv[++i]);
+    else if (!strcmp(o, "-p") && left >= 1)
+      src = atoi(argv[++i]);
+    else if (!strcmp(o, "-r") && left >= 1)
+      rate = atof(argv[++i]);
+    else if (!strcmp(o, "-x") && left >= 1)
+      xfer = atoi(argv[++i]);
+    else if (!strcmp(o, "-b") && left >= 2)
+    {
+      budget[0] = atoi(argv[++i]);
+      budget[1] = atoi(argv[++i]);
+    }
+    else if (!strcmp(o, "-n") && left >= 1)
+      noteEvery = atoi(argv[++i]);
+    else if (!strcmp(o, "-f") && left >= 1)
+      fastEvery = atoi(argv[++i]);
+    else if (!strcmp(o, "-P") && left >= 1)
+      pingEvery = atoi(argv[++i]);
+    else if (!strcmp(o, "-i") && left >= 2)
+    {
+      stallAt  = atof(argv[++i]);
+      stallLen = atof(argv[++i]);
+    }
+    else if (!strcmp(o, "-w") && left >= 2)
+    {
+      pollOn  = atof(argv[++i]) * TICKS_PER_MS;
+      pollOff = atof(argv[++i]) * TICKS_PER_MS;
+    }
+    else if (!strcmp(o, "-R") && left >= 2)
+    {
+      resetAt   = atof(argv[++i]);
+      resetPort = atoi(argv[++i]) & 1;
+    }
+    else if (!strcmp(o, "-e") && left >= 2)
+    {
+      errorAt   = atof(argv[++i]);
+      errorPort = atoi(argv[++i]) & 1;
+    }
+    else if (!strcmp(o, "-j") && left >= 1)
+      interleaveSeed = strtoul(argv[++i], NULL, 0);
+    else
+    {
+      usage();
+      return 1;
+    }
+  }
+  if (msgSize < 8 || msgSize > MAX_SIZE || seconds <= 0 || src < 0 || src >= SIM_PORTS || !budget[0] || !budget[1] || (pollOff && !pollOn))
+  {
+    usage();
+    return 1;
+  }
+  int const dst = src ^ 1;
+  rx.port       = dst;
+
+  setvbuf(stdout, NULL, _IONBF, 0);
+  SIM_SetInterleave(interleaveSeed);
+  SIM_Init();
+  SIM_HostSetRxCallback(onHostRx);
+  SIM_HostSetFastRxCallback(onHostFastRx);
+  SIM_FwEnter();
+  MIDI_Relay_Init();
+  SIM_FwLeave();
+  SIM_Attach(0, 1);
+  SIM_Attach(1, 0);
+  if (!enumerate(0) || !enumerate(1))
+    return 2;
+  for (int port = 0; port < SIM_PORTS; port++)
+    SIM_HostSetPacketBudget(port, budget[port], budget[port]);
+  SIM_HostSetTransferSize(src, xfer ? xfer : (src == 0) ? 512 : 64);
+  for (int i = 0; i < 100 * TICKS_PER_MS; i++)
+    runTick();  // the relay starts once both ports are configured
+
+  static uint8_t msg[MAX_SIZE * 4 / 3 + 4];
+  uint64_t const start      = ticker;
+  uint64_t const ticks      = seconds * 1000 * TICKS_PER_MS;
+  uint32_t       seq        = 0, noteSeq = 0;
+  int            errorState = 0;
+  uint64_t       errorTick  = 0;
+  int const      disrupted  = (resetAt >= 0 || errorAt >= 0);  // data is lost without being counted
+
+  while (ticker - start < ticks)
+  {
+    uint64_t const now = ticker - start;
+    double const   ms  = (double) now / TICKS_PER_MS;
+
+    // keep a few messages in the sending host's queue, or the rate asked for
+    while (SIM_HostOutPending(src) < 4 * msgSize && (rate <= 0 || (double) seq * msgSize < rate * ms / 1000))
+    {
+      sysexSent[seq % SEQ_SLOTS] = ticker;
+      SIM_HostQueueOut(src, msg, makeSysex(seq++, msg));
+    }
+    if (noteEvery && now % noteEvery == 0)
+    {
+      uint8_t const note[4]           = { 0x09, 0x90, noteSeq & 0x7F, (noteSeq >> 7) & 0x7F };
+      noteSent[noteSeq++ % SEQ_SLOTS] = ticker;
+      SIM_HostQueueOut(src, note, sizeof note);
+    }
+    if (fastEvery && now % fastEvery == 0)
+    {
+      uint8_t const note[4] = { 0x09, 0x90, fastSeq & 0x7F, (fastSeq >> 7) & 0x7F };
+      if (SIM_HostQueueFastOut(src, note, sizeof note))  // a full queue blocks the sender
+        fastSent[fastSeq++ % SEQ_SLOTS] = ticker;
+    }
+    if (pingEvery && now % pingEvery == 0)
+    {
+      uint8_t const data[4] = { pingSeq & 0x7F, (pingSeq >> 7) & 0x7F, (pingSeq >> 14) & 0x7F, (pingSeq >> 21) & 0x7F };
+      uint8_t       ping[64];
+      pingSent[pingSeq++ % SEQ_SLOTS] = ticker;
+      SIM_HostQueueOut(src, ping, makeDevCtl(CMD_PING_L, data, sizeof data, ping));
+    }
+    if (stallAt >= 0 || pollOff)
+      SIM_HostSetInPolling(dst, !(ms >= stallAt && ms < stallAt + stallLen) && (!pollOff || now % (pollOn + pollOff) < pollOn));
+    if (resetAt >= 0 && ms >= resetAt)
+    {  // reset signalling and the recovery time after it take a host 20ms at least
+      enumerateAt = resetAt + 20;
+      resetAt     = -1;
+      SIM_BusReset(resetPort);
+    }
+    if (enumerateAt >= 0 && ms >= enumerateAt)
+    {
+      enumerateAt = -1;
+      if (!enumerate(resetPort))
+        return 2;
+    }
+    if (errorAt >= 0)
+    {
+      if (errorState == 0 && ms >= errorAt)
+      {  // the firmware takes the controller down and brings it up again
+        simUsbRegs[errorPort].USBSTS_D |= USBSTS_UEI;
+        errorState = 1;
+      }
+      else if (errorState == 1 && !USB_MIDI_IsConfigured(errorPort))
+      {
+        errorState = 2;
+        errorTick  = ticker;
+      }
+      else if (errorState == 2 && ticker - errorTick >= 100 * TICKS_PER_MS)
+      {
+        SIM_BusReset(errorPort);
+        if (!enumerate(errorPort))
+          return 2;
+        errorState = 3;
+      }
+    }
+    runTick();
+  }
+  if (stallAt >= 0 || pollOff)
+    SIM_HostSetInPolling(dst, 1);
+  for (int i = 0; i < 100 * TICKS_PER_MS; i++)
+    runTick();  // what is still under way arrives
+  rx.corrupted += rx.suspect;
+
+  double const secs = (rx.lastTick > rx.firstTick) ? (double) (rx.lastTick - rx.firstTick) / (1000 * TICKS_PER_MS) : 1;
+  printf("port %d --> %d, %u byte messages, %.1fs : %.1f kB/s\n", src, dst, msgSize, seconds, rx.bytes / secs / 1000);
+  printf("messages: sent %u, received %" PRIu64 ", lost %" PRIu64 " (%" PRIu64 " cut off), corrupted %" PRIu64 "\n", seq, rx.msgs, rx.lost, rx.cut,
+         rx.corrupted);
+  report("sysex", &rx.sysex);
+  report("notes", &rx.notes);
+  report("fast", &fast);
+  report("pings", &pings);
+  if (noteEvery)
+    printf("notes  : sent %u, out of order %" PRIu64 "\n", noteSeq, rx.notesBehind);
+  if (fastEvery)
+    printf("fast   : sent %u, dropped by the bridge %u\n", fastSeq, MIDI_Relay_GetDropStats(src)->fastEvents);
+  if (pingEvery)
+    printf("pings  : sent %u\n", pingSeq);
+  printf("bus    : OUT packets %" PRIu64 " NAKed %" PRIu64 ", IN packets %" PRIu64 " NAKed %" PRIu64 ", interrupts %" PRIu64 " / %" PRIu64 "\n",
+         simStats[src].outPackets, simStats[src].outNaks, simStats[dst].inPackets, simStats[dst].inNaks, simStats[src].irqs, simStats[dst].irqs);
+
+  RelayDropStats_t const *const    drops   = MIDI_Relay_GetDropStats(src);
+  RelayTrafficStats_t const *const traffic = MIDI_Relay_GetTrafficStats(src);
+  printf("drops  : timeouts %u, oldest %u, newest %u, packets dropped %u, incoming %u\n", drops->timeouts, drops->oldest, drops->newest,
+         traffic->dropped, traffic->droppedIncoming);
+  RelayReceiveStats_t const *const receive = MIDI_Relay_GetReceiveStats(src);
+  printf("receive: malformed events %u, oversize transfers %u, transfers with the queue full %u\n", receive->malformedEvents,
+         receive->oversize, receive->unexpected);
+#ifdef LOSSLESS_BUFFERING
+  ArenaStats_t const *const arena = ARENA_GetStats(src);
+  printf("arena  : peak %u bytes of %u, both directions %u, packets that did not fit %u\n", arena->highWater * ARENA_CHUNK_SIZE,
+         ARENA_CHUNKS * ARENA_CHUNK_SIZE, ARENA_GetTotalStats()->highWater * ARENA_CHUNK_SIZE, arena->failed);
+#endif
+  if (errorState)
+  {
+    RelayRecoveryStats_t const *const rs = MIDI_Relay_GetRecoveryStats(errorPort);
+    printf("errors : faults %u, recovered %u, down for %.1fms\n", rs->faults, rs->recovered, (double) rs->lastTicks / TICKS_PER_MS);
+  }
+  int const unaccounted = !disrupted && (rx.lost || rx.cut) && !drops->timeouts && !traffic->dropped && !traffic->droppedIncoming;
+  if (unaccounted)
+    printf("FAILED : messages lost, but the bridge counted no drop\n");
+  int const unexpected = receive->oversize || receive->unexpected;
+  if (unexpected)
+    printf("FAILED : the bridge received a transfer it had no buffer for\n");
+  return (rx.corrupted || rx.notesBehind || unaccounted || unexpected) ? 1 : 0;
+}